@@ -0,0 +1,78 @@
+/*
+    Бенчмарк массового входа игроков.
+
+    Моделирует начало турнира: в одну сессию подряд входят тысячи игроков.
+    Входы обрабатываются пачками, как если бы они скопились в очереди strand,
+    после каждой пачки публикуются отложенные снимки и переносятся в шарды токены.
+    Пачка из одного входа соответствует публикации снимка и копии шарда на каждый вход.
+
+    Запуск: join_benchmark [игроков]
+*/
+#include "../src/app.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace {
+
+using namespace std::literals;
+
+model::Game MakeGame(){
+    model::Game game;
+    model::Map map(model::Map::Id("town"s), "Town"s);
+    for(int i = 0; i < 100; ++i){
+        map.AddRoad(model::Road{model::Road::HORIZONTAL, {0, i * 10}, 990});
+        map.AddRoad(model::Road{model::Road::VERTICAL, {i * 10, 0}, 990});
+    }
+    model::LootType loot_type;
+    loot_type.value = 1;
+    map.AddLootType(loot_type);
+    map.AddBagCapacity(3);
+
+    game.AddMap(std::move(map));
+    game.SetLootGenerator(5000, 0.5);
+    game.SetRandomSeed(1);
+    return game;
+}
+
+/* Возвращает число входов в секунду */
+double Run(unsigned players_count, unsigned batch, bool reserve){
+    model::Game game = MakeGame();
+    model::Players players;
+    model::PlayerTokens tokens;
+    app::GameUseCase use_case(players, tokens, nullptr);
+    if(reserve){
+        players.Reserve(players_count);
+        tokens.Reserve(players_count);
+        use_case.Reserve(players_count);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < players_count; ++i){
+        use_case.JoinGame("player"s + std::to_string(i), "town"s, game, true);
+        if((i + 1) % batch == 0){
+            use_case.PublishPendingSnapshots();
+        }
+    }
+    use_case.PublishPendingSnapshots();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return players_count / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]){
+    unsigned players_count = argc > 1 ? std::stoul(argv[1]) : 5'000;
+    std::cout << "players: " << players_count << std::endl;
+
+    for(bool reserve : {false, true}){
+        for(unsigned batch : {1u, 64u, 1024u}){
+            std::cout << "batch " << std::setw(4) << batch << (reserve ? ", reserved" : ", no reserve") << ": "
+                      << std::fixed << std::setprecision(0) << Run(players_count, batch, reserve)
+                      << " joins/s" << std::endl;
+        }
+    }
+}
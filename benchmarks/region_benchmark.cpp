@@ -0,0 +1,123 @@
+/*
+    Бенчмарк пространственной декомпозиции одной большой сессии.
+
+    Строит синтетическую карту-решётку из 100 000 дорог, заселяет её собаками
+    и трофеями и замеряет среднее время тика при разном числе потоков.
+    Число полос фиксировано, поэтому разница во времени показывает
+    именно масштабирование по потокам.
+
+    Запуск: region_benchmark [собак] [тиков]
+*/
+#include "../src/model.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace {
+
+using namespace model;
+using namespace std::literals;
+
+constexpr int ROADS_PER_AXIS = 50'000;
+constexpr int ROAD_STEP = 10;
+constexpr unsigned REGIONS = 64;
+constexpr unsigned TICK_MS = 50;
+constexpr uint64_t SEED = 20240601;
+
+Game MakeGame(unsigned threads){
+    Game game;
+    Map map(Map::Id("bench"s), "Benchmark grid"s);
+
+    const Coord last = (ROADS_PER_AXIS - 1) * ROAD_STEP;
+    for(int i = 0; i < ROADS_PER_AXIS; ++i){
+        map.AddRoad(Road{Road::HORIZONTAL, {0, i * ROAD_STEP}, last});
+        map.AddRoad(Road{Road::VERTICAL, {i * ROAD_STEP, 0}, last});
+    }
+    for(int i = 0; i < 1000; ++i){
+        int pos = i * (ROADS_PER_AXIS / 1000) * ROAD_STEP;
+        map.AddOffice(Office(Office::Id("office"s + std::to_string(i)), {pos, pos}, {0, 0}));
+    }
+
+    LootType loot_type;
+    loot_type.value = 10;
+    map.AddLootType(loot_type);
+    map.AddBagCapacity(3);
+
+    game.AddMap(std::move(map));
+    game.SetLootGenerator(5000, 0.5);
+    game.SetRandomSeed(SEED);
+    if(threads > 0){
+        game.SetRegionDecomposition(threads, REGIONS);
+    }
+    return game;
+}
+
+/* Остановившиеся собаки выбирают новое направление, как будто игрок нажал клавишу */
+void MoveDogs(GameSession& session, util::Random& random, double speed){
+    for(Dog& dog : session.GetDogs()){
+        if(*dog.GetSpeed() != PairDouble{0, 0}){
+            continue;
+        }
+        switch(random.NextBelow(4)){
+            case 0: dog.SetSpeed(Dog::Speed({speed, 0})); break;
+            case 1: dog.SetSpeed(Dog::Speed({-speed, 0})); break;
+            case 2: dog.SetSpeed(Dog::Speed({0, speed})); break;
+            default: dog.SetSpeed(Dog::Speed({0, -speed})); break;
+        }
+    }
+}
+
+/* Возвращает среднее время тика в миллисекундах */
+double Run(unsigned threads, unsigned dogs_count, unsigned ticks, unsigned& score){
+    Game game = MakeGame(threads);
+    GameSession* session = game.AddSession(Map::Id("bench"s));
+    for(unsigned i = 0; i < dogs_count; ++i){
+        session->AddDog(i, Dog::Name("dog"s), Dog::Position(session->GetRandomPos()),
+                        Dog::Speed({0, 0}), Direction::NORTH);
+    }
+    session->UpdateLoot(session->GetLootShortage());
+    game.ScheduleLootSpawn(session);
+
+    util::Random random(SEED);
+    std::chrono::steady_clock::duration total{0};
+    for(unsigned tick = 0; tick < ticks; ++tick){
+        MoveDogs(*session, random, 4.0);
+        auto start = std::chrono::steady_clock::now();
+        game.UpdateGameState(TICK_MS);
+        total += std::chrono::steady_clock::now() - start;
+    }
+
+    score = 0;
+    for(const Dog& dog : session->GetDogs()){
+        score += dog.GetScore() + (*dog.GetBag()).size();
+    }
+    return std::chrono::duration<double, std::milli>(total).count() / ticks;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]){
+    unsigned dogs_count = argc > 1 ? std::stoul(argv[1]) : 20'000;
+    unsigned ticks = argc > 2 ? std::stoul(argv[2]) : 10;
+
+    std::cout << "roads: " << 2 * ROADS_PER_AXIS << ", dogs: " << dogs_count
+              << ", regions: " << REGIONS << ", ticks: " << ticks << std::endl;
+
+    unsigned baseline_score = 0;
+    double baseline = Run(0, dogs_count, ticks, baseline_score);
+    std::cout << "without regions: " << std::fixed << std::setprecision(2)
+              << baseline << " ms/tick" << std::endl;
+
+    double single = 0;
+    for(unsigned threads : {1u, 2u, 4u, 8u, 16u}){
+        unsigned score = 0;
+        double time = Run(threads, dogs_count, ticks, score);
+        if(threads == 1){
+            single = time;
+        }
+        std::cout << std::setw(2) << threads << " threads: " << time << " ms/tick, speedup x"
+                  << single / time << (score == baseline_score ? "" : " (score mismatch!)") << std::endl;
+    }
+}
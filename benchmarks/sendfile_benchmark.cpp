@@ -0,0 +1,157 @@
+/*
+    Бенчмарк отправки крупных статических файлов.
+
+    Сервер отдаёт один и тот же файл по loopback-соединению несколько раз подряд
+    двумя способами: через http::file_body (чтение в буфер и запись в сокет)
+    и через SendfileBody (sendfile из кэша страниц прямо в сокет).
+    Клиент в отдельном потоке читает и отбрасывает данные.
+    Пропускная способность на ядро считается по процессорному времени потока сервера.
+
+    Запуск: sendfile_benchmark [размер файла в МБ] [повторов]
+*/
+#include "../src/sendfile_body.h"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/http.hpp>
+#include <array>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace fs = std::filesystem;
+using tcp = net::ip::tcp;
+
+using SendFn = std::function<void(tcp::socket&, const fs::path&, std::function<void(beast::error_code)>)>;
+
+double ThreadCpuSeconds(){
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+fs::path MakeFile(size_t megabytes){
+    fs::path path = fs::temp_directory_path() / "sendfile_benchmark.bin";
+    std::ofstream file(path, std::ios::binary);
+    std::string block(1024 * 1024, 'x');
+    for(size_t i = 0; i < megabytes; ++i){
+        file.write(block.data(), block.size());
+    }
+    return path;
+}
+
+void SendWithFileBody(tcp::socket& socket, const fs::path& path, std::function<void(beast::error_code)> done){
+    auto response = std::make_shared<http::response<http::file_body>>(http::status::ok, 11);
+    beast::error_code ec;
+    response->body().open(path.c_str(), beast::file_mode::read, ec);
+    response->prepare_payload();
+    http::async_write(socket, *response, [response, done](beast::error_code ec, size_t){
+        done(ec);
+    });
+}
+
+void SendWithSendfile(tcp::socket& socket, const fs::path& path, std::function<void(beast::error_code)> done){
+    using Response = http::response<sendfile_body::SendfileBody>;
+    struct State{
+        explicit State(Response&& response)
+            : response(std::move(response)), serializer(this->response){
+        }
+        Response response;
+        http::response_serializer<sendfile_body::SendfileBody> serializer;
+    };
+
+    Response response(http::status::ok, 11);
+    beast::error_code ec;
+    response.body().Open(path.c_str(), ec);
+    response.content_length(response.body().GetSize());
+
+    auto state = std::make_shared<State>(std::move(response));
+    http::async_write_header(socket, state->serializer, [&socket, state, done](beast::error_code ec, size_t){
+        if(ec){
+            return done(ec);
+        }
+        const auto& body = state->response.body();
+        sendfile_body::AsyncSendFile(socket, body.GetFd(), 0, body.GetSize(), [state, done](beast::error_code ec, size_t){
+            done(ec);
+        });
+    });
+}
+
+struct Result{
+    double wall_mb_per_s;
+    double cpu_mb_per_s;
+};
+
+Result Run(const fs::path& path, size_t repeats, const SendFn& send){
+    net::io_context ioc;
+    tcp::acceptor acceptor(ioc, {net::ip::make_address("127.0.0.1"), 0});
+    auto endpoint = acceptor.local_endpoint();
+
+    std::thread client([endpoint]{
+        net::io_context client_ioc;
+        tcp::socket socket(client_ioc);
+        socket.connect(endpoint);
+        std::array<char, 256 * 1024> buffer;
+        beast::error_code ec;
+        while(!ec){
+            socket.read_some(net::buffer(buffer), ec);
+        }
+    });
+
+    tcp::socket socket = acceptor.accept();
+    uint64_t total = fs::file_size(path) * repeats;
+    size_t sent = 0;
+
+    std::function<void(beast::error_code)> next = [&](beast::error_code ec){
+        if(ec){
+            std::cerr << "send failed: " << ec.message() << std::endl;
+            return;
+        }
+        if(sent++ < repeats){
+            send(socket, path, next);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    double cpu_start = ThreadCpuSeconds();
+    next({});
+    ioc.run();
+    double cpu = ThreadCpuSeconds() - cpu_start;
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+    socket.shutdown(tcp::socket::shutdown_both);
+    socket.close();
+    client.join();
+
+    double megabytes = total / (1024.0 * 1024.0);
+    return {megabytes / wall.count(), megabytes / cpu};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]){
+    size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 64;
+    size_t repeats = argc > 2 ? std::stoul(argv[2]) : 16;
+    fs::path path = MakeFile(megabytes);
+    std::cout << "file: " << megabytes << " MB, repeats: " << repeats << std::endl;
+
+    for(auto [name, send] : {std::pair<const char*, SendFn>{"file_body", SendWithFileBody},
+                             std::pair<const char*, SendFn>{"sendfile ", SendWithSendfile}}){
+        Result result = Run(path, repeats, send);
+        std::cout << name << ": " << std::fixed << std::setprecision(0)
+                  << result.wall_mb_per_s << " MB/s, "
+                  << result.cpu_mb_per_s << " MB/s per core" << std::endl;
+    }
+    fs::remove(path);
+}
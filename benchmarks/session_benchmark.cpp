@@ -0,0 +1,124 @@
+/*
+    Бенчмарк движков HTTP-сессий.
+
+    Сервер в одном потоке обслуживает несколько keep-alive соединений,
+    клиенты в отдельных потоках последовательно отправляют запросы и читают ответы.
+    Сравниваются сессии на цепочках обработчиков (Session) и на сопрограммах (CoroSession):
+    число запросов в секунду и число выделений памяти в потоке сервера на один запрос.
+    Выделения на журналирование одинаковы для обоих движков.
+
+    Запуск: session_benchmark [соединений] [запросов на соединение]
+*/
+#include "../src/http_server.h"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+thread_local bool count_allocations = false;
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void* operator new(std::size_t size){
+    if(count_allocations){
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(void* pointer = std::malloc(size == 0 ? 1 : size)){
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept{
+    std::free(pointer);
+}
+
+namespace {
+
+using namespace std::literals;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = net::ip::tcp;
+
+struct Result{
+    double requests_per_second;
+    double allocations_per_request;
+};
+
+Result Run(bool coroutines, unsigned connections, unsigned requests){
+    net::io_context ioc(1);
+    tcp::endpoint endpoint(net::ip::make_address("127.0.0.1"), coroutines ? 18090 : 18091);
+
+    auto handler = [](auto&& req, const auto&, auto&& send){
+        http::response<http::string_body> response(http::status::ok, req.version());
+        response.set(http::field::content_type, "application/json"sv);
+        response.body() = R"([{"id":"map1","name":"Map 1"}])"s;
+        response.keep_alive(req.keep_alive());
+        response.prepare_payload();
+        send(std::move(response));
+    };
+    http_server::ServeHttp(ioc, endpoint, handler, {.single_threaded = true, .coroutine_sessions = coroutines});
+
+    std::thread server([&ioc]{
+        count_allocations = true;
+        ioc.run();
+    });
+
+    allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for(unsigned i = 0; i < connections; ++i){
+        clients.emplace_back([endpoint, requests]{
+            net::io_context client_ioc;
+            tcp::socket socket(client_ioc);
+            socket.connect(endpoint);
+            beast::flat_buffer buffer;
+            http::request<http::empty_body> request(http::verb::get, "/api/v1/maps", 11);
+            request.set(http::field::host, "localhost"sv);
+            for(unsigned j = 0; j < requests; ++j){
+                http::write(socket, request);
+                http::response<http::string_body> response;
+                http::read(socket, buffer, response);
+            }
+        });
+    }
+    for(auto& client : clients){
+        client.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    ioc.stop();
+    server.join();
+
+    double total = static_cast<double>(connections) * requests;
+    return {total / elapsed.count(), allocations / total};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]){
+    boost::log::core::get()->set_logging_enabled(false);
+    unsigned connections = argc > 1 ? std::stoul(argv[1]) : 8;
+    unsigned requests = argc > 2 ? std::stoul(argv[2]) : 20'000;
+    std::cout << "connections: " << connections << ", requests per connection: " << requests << std::endl;
+
+    for(bool coroutines : {false, true}){
+        Result result = Run(coroutines, connections, requests);
+        std::cout << (coroutines ? "coroutines: " : "callbacks:  ") << std::fixed << std::setprecision(0)
+                  << result.requests_per_second << " req/s, " << std::setprecision(1)
+                  << result.allocations_per_request << " allocations per request" << std::endl;
+    }
+}
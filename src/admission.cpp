@@ -0,0 +1,51 @@
+#include "admission.h"
+
+#include <algorithm>
+
+namespace admission {
+
+/* ------------------------ LoadMonitor ----------------------------------- */
+
+void LoadMonitor::Start(){
+    ScheduleProbe();
+}
+
+void LoadMonitor::ScheduleProbe(){
+    timer_.expires_after(PROBE_PERIOD);
+    probe_deadline_.store(timer_.expiry().time_since_epoch().count(), std::memory_order_relaxed);
+    timer_.async_wait([self = shared_from_this()](sys::error_code ec){
+        self->OnProbe(ec);
+    });
+}
+
+void LoadMonitor::OnProbe(sys::error_code ec){
+    if(ec){
+        return;
+    }
+    lag_.store((Clock::now() - timer_.expiry()).count(), std::memory_order_relaxed);
+    ScheduleProbe();
+}
+
+Milliseconds LoadMonitor::GetLoopLag() const noexcept{
+    Clock::duration lag(lag_.load(std::memory_order_relaxed));
+    // Пока зонд не запущен, срок не назначен и опоздание не учитывается
+    if(Clock::rep deadline = probe_deadline_.load(std::memory_order_relaxed); deadline != 0){
+        lag = std::max(lag, Clock::now() - Clock::time_point(Clock::duration(deadline)));
+    }
+    return std::chrono::duration_cast<Milliseconds>(lag);
+}
+
+bool LoadMonitor::Admit(Priority priority) const noexcept{
+    if(priority == Priority::CRITICAL){
+        return true;
+    }
+    if(limits_.max_queue_depth && GetQueueDepth() > *limits_.max_queue_depth){
+        return false;
+    }
+    if(limits_.max_loop_lag && GetLoopLag() > *limits_.max_loop_lag){
+        return false;
+    }
+    return true;
+}
+
+} // namespace admission
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace admission {
+
+namespace net = boost::asio;
+namespace sys = boost::system;
+using Clock = std::chrono::steady_clock;
+using Milliseconds = std::chrono::milliseconds;
+
+/* Приоритет запроса: при перегрузке отклоняются только запросы с низким приоритетом */
+enum class Priority{
+    LOW,
+    CRITICAL
+};
+
+/* Пороги перегрузки. Незаданный порог не проверяется */
+struct Limits{
+    std::optional<Milliseconds> max_loop_lag;
+    std::optional<size_t> max_queue_depth;
+    std::chrono::seconds retry_after{1};
+};
+
+/* ------------------------ LoadMonitor ----------------------------------- */
+
+/*
+    Следит за нагрузкой сервера и решает, принимать ли запрос.
+    Задержка цикла событий измеряется таймером-зондом в io_context:
+    насколько позже назначенного срока он срабатывает.
+    Глубина очереди - число запросов, переданных в strand API, но ещё не начатых.
+    Все методы, кроме Start, можно вызывать из любого потока
+*/
+class LoadMonitor : public std::enable_shared_from_this<LoadMonitor>{
+public:
+    static constexpr Milliseconds PROBE_PERIOD{50};
+
+    LoadMonitor(net::io_context::executor_type executor, Limits limits)
+        : timer_{executor}
+        , limits_{limits}{
+    }
+
+    void Start();
+
+    /* Учёт очереди strand API: вызываются до передачи запроса в strand и в начале его обработки */
+    void OnEnqueued() noexcept{
+        queue_depth_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void OnDequeued() noexcept{
+        queue_depth_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    size_t GetQueueDepth() const noexcept{
+        return queue_depth_.load(std::memory_order_relaxed);
+    }
+
+    /*
+        Последняя измеренная задержка цикла событий.
+        Если зонд уже опаздывает, учитывается и текущее опоздание:
+        заблокированный цикл виден сразу, а не после срабатывания зонда
+    */
+    Milliseconds GetLoopLag() const noexcept;
+
+    bool Admit(Priority priority) const noexcept;
+
+    std::chrono::seconds GetRetryAfter() const noexcept{
+        return limits_.retry_after;
+    }
+private:
+    void ScheduleProbe();
+
+    void OnProbe(sys::error_code ec);
+
+    net::steady_timer timer_;
+    Limits limits_;
+    std::atomic<size_t> queue_depth_{0};
+    std::atomic<Clock::rep> lag_{0};
+    std::atomic<Clock::rep> probe_deadline_{0};
+};
+
+} // namespace admission
@@ -1,4 +1,6 @@
 #include "app.h"
+#include "etag.h"
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 
@@ -78,8 +80,378 @@ Milliseconds PlayerTimeClock::GetPlaytime() const{
     return duration_cast<Milliseconds>(current_playtime - log_in_time_);
 }
 
+/* ------------------------ SnapshotRegistry ----------------------------------- */
+
+uint64_t SnapshotRegistry::NextVersion(){
+    return ++version_;
+}
+
+void SnapshotRegistry::Publish(const GameSession* session, SnapshotPtr snapshot){
+    SlotPtr slot = GetSlot(session);
+    /* Снимок меняется только внутри strand, поэтому предыдущий читается без гонки */
+    SnapshotPtr previous = std::atomic_exchange(&slot->snapshot, snapshot);
+    if(!slot->subscribers.empty()){
+        Notify(*slot, std::move(snapshot), previous);
+    }
+}
+
+void SnapshotRegistry::Subscribe(const GameSession* session, std::weak_ptr<SnapshotSubscriber> subscriber){
+    GetSlot(session)->subscribers.push_back(std::move(subscriber));
+}
+
+void SnapshotRegistry::Notify(Slot& slot, SnapshotPtr snapshot, const SnapshotPtr& previous){
+    /* Кадры сериализуются не более одного раза на сессию и только по запросу подписчика */
+    bool players_changed = !previous || previous->player_list != snapshot->player_list;
+    SnapshotUpdate update(std::move(snapshot), players_changed);
+
+    auto& subscribers = slot.subscribers;
+    for(size_t i = 0; i < subscribers.size();){
+        if(auto subscriber = subscribers[i].lock()){
+            subscriber->OnSnapshot(update);
+            ++i;
+        } else {
+            /* Отключившийся подписчик удаляется перестановкой с последним */
+            subscribers[i] = std::move(subscribers.back());
+            subscribers.pop_back();
+        }
+    }
+}
+
+void SnapshotRegistry::AddToken(const Token& token, const GameSession* session){
+    SlotPtr slot = GetSlot(session);
+    std::lock_guard lock(pending_mutex_);
+    pending_tokens_.insert_or_assign(token, std::move(slot));
+}
+
+void SnapshotRegistry::FlushTokens(){
+    if(pending_tokens_.empty()){
+        return;
+    }
+
+    /* Вход пачки игроков копирует каждый затронутый шард один раз, а не на каждого игрока */
+    std::array<std::shared_ptr<TokenToSlot>, TOKEN_SHARDS> updated;
+    for(const auto& [token, slot] : pending_tokens_){
+        size_t index = GetShardIndex(token);
+        if(!updated[index]){
+            const TokenShardPtr& shard = token_shards_[index];
+            updated[index] = shard ? std::make_shared<TokenToSlot>(*shard) : std::make_shared<TokenToSlot>();
+        }
+        updated[index]->insert_or_assign(token, slot);
+    }
+
+    for(size_t i = 0; i < TOKEN_SHARDS; ++i){
+        if(updated[i]){
+            std::atomic_store(&token_shards_[i], TokenShardPtr(std::move(updated[i])));
+        }
+    }
+
+    /* Очередь очищается только после подмены шардов, чтобы токен не пропадал для читателей */
+    std::lock_guard lock(pending_mutex_);
+    pending_tokens_.clear();
+}
+
+void SnapshotRegistry::RemoveToken(const Token& token){
+    if(pending_tokens_.contains(token)){
+        std::lock_guard lock(pending_mutex_);
+        pending_tokens_.erase(token);
+    }
+
+    size_t index = GetShardIndex(token);
+    TokenShardPtr& shard = token_shards_[index];
+    if(!shard || !shard->contains(token)){
+        return;
+    }
+
+    auto updated = std::make_shared<TokenToSlot>(*shard);
+    updated->erase(token);
+    std::atomic_store(&shard, TokenShardPtr(std::move(updated)));
+}
+
+void SnapshotRegistry::ResetTokens(const TokenToPlayer& tokens){
+    std::array<std::shared_ptr<TokenToSlot>, TOKEN_SHARDS> shards;
+    for(auto& shard : shards){
+        shard = std::make_shared<TokenToSlot>();
+    }
+
+    for(const auto& [token, player] : tokens){
+        shards[GetShardIndex(token)]->insert_or_assign(token, GetSlot(player->GetSession()));
+    }
+
+    for(size_t i = 0; i < TOKEN_SHARDS; ++i){
+        std::atomic_store(&token_shards_[i], TokenShardPtr(std::move(shards[i])));
+    }
+
+    /* Все выданные токены уже в шардах */
+    std::lock_guard lock(pending_mutex_);
+    pending_tokens_.clear();
+}
+
+SnapshotPtr SnapshotRegistry::FindByToken(const Token& token) const{
+    SlotPtr slot = FindSlotByToken(token);
+    return slot ? std::atomic_load(&slot->snapshot) : nullptr;
+}
+
+bool SnapshotRegistry::ContainsToken(const Token& token) const{
+    return FindSlotByToken(token) != nullptr;
+}
+
+SnapshotPtr SnapshotRegistry::FindBySession(const GameSession* session) const{
+    auto it = slots_.find(session);
+    return it != slots_.end() ? std::atomic_load(&it->second->snapshot) : nullptr;
+}
+
+bool SnapshotRegistry::IsPublished(const GameSession* session) const{
+    auto it = slots_.find(session);
+    return it != slots_.end() && std::atomic_load(&it->second->snapshot) != nullptr;
+}
+
+SnapshotRegistry::SlotPtr SnapshotRegistry::GetSlot(const GameSession* session){
+    SlotPtr& slot = slots_[session];
+    if(!slot){
+        slot = std::make_shared<Slot>();
+    }
+    return slot;
+}
+
+size_t SnapshotRegistry::GetShardIndex(const Token& token) const{
+    return util::TaggedHasher<Token>()(token) % TOKEN_SHARDS;
+}
+
+SnapshotRegistry::SlotPtr SnapshotRegistry::FindSlotByToken(const Token& token) const{
+    TokenShardPtr shard = std::atomic_load(&token_shards_[GetShardIndex(token)]);
+    if(shard){
+        if(auto it = shard->find(token); it != shard->end()){
+            return it->second;
+        }
+    }
+
+    /* Промах - это либо чужой токен, либо игрок вошёл после последнего переноса очереди */
+    std::lock_guard lock(pending_mutex_);
+    auto it = pending_tokens_.find(token);
+    return it != pending_tokens_.end() ? it->second : nullptr;
+}
+
 } // namespace detail
 
+/* ------------------------ SessionSnapshot ----------------------------------- */
+
+namespace {
+
+/* Дописывает сущности объектом {"id":{...},...} */
+void AppendEntities(std::string& out, const std::vector<SnapshotEntities::Entity>& entities){
+    out.push_back('{');
+    for(const auto& [id, entity] : entities){
+        if(out.back() != '{'){
+            out.push_back(',');
+        }
+        out.append("\"").append(std::to_string(id)).append("\":").append(entity);
+    }
+    out.push_back('}');
+}
+
+/* 
+    Дописывает разность двух упорядоченных по id наборов сущностей:
+    новые и изменившиеся - объектом по ключу changed_key, исчезнувшие - массивом id по ключу removed_key
+*/
+void AppendEntitiesDelta(std::string& out, std::string_view changed_key, std::string_view removed_key,
+                            const std::vector<SnapshotEntities::Entity>& older, 
+                            const std::vector<SnapshotEntities::Entity>& newer){
+    std::vector<SnapshotEntities::Entity> changed;
+    std::string removed = "[";
+    auto remove = [&removed](uint64_t id){
+        if(removed.back() != '['){
+            removed.push_back(',');
+        }
+        removed.append("\"").append(std::to_string(id)).append("\"");
+    };
+
+    size_t i = 0, j = 0;
+    while(i < older.size() || j < newer.size()){
+        if(j == newer.size() || (i < older.size() && older[i].first < newer[j].first)){
+            remove(older[i++].first);
+        } else if(i == older.size() || newer[j].first < older[i].first){
+            changed.push_back(newer[j++]);
+        } else {
+            if(older[i].second != newer[j].second){
+                changed.push_back(newer[j]);
+            }
+            ++i;
+            ++j;
+        }
+    }
+    removed.push_back(']');
+
+    out.append("\"").append(changed_key).append("\":");
+    AppendEntities(out, changed);
+    out.append(",\"").append(removed_key).append("\":").append(removed);
+}
+
+SharedPayload MakeFullState(const SnapshotEntities& entities){
+    std::string result = R"({"players":)";
+    AppendEntities(result, entities.players);
+    result.append(R"(,"lostObjects":)");
+    AppendEntities(result, entities.lost_objects);
+    result.push_back('}');
+    return std::make_shared<const std::string>(std::move(result));
+}
+
+SharedPayload MakeStateDelta(const SnapshotEntities& older, const SnapshotEntities& newer){
+    using namespace std::literals;
+    std::string delta;
+    delta.append(R"({"since":)").append(std::to_string(older.version))
+         .append(R"(,"version":)").append(std::to_string(newer.version)).push_back(',');
+    AppendEntitiesDelta(delta, "players"sv, "removedPlayers"sv, older.players, newer.players);
+    delta.push_back(',');
+    AppendEntitiesDelta(delta, "lostObjects"sv, "removedObjects"sv, older.lost_objects, newer.lost_objects);
+    delta.push_back('}');
+    return std::make_shared<const std::string>(std::move(delta));
+}
+
+/* 
+    Вариант тела body с ключом key, сжатый кодированием coding. Строится один раз на снимок;
+    если сжатие не окупается, в кэше остаётся nullptr и отдаётся само body
+*/
+EncodedBody CompressOnce(const SessionSnapshot& snapshot, PayloadKey key, SharedPayload body, compression::Coding coding){
+    if(coding == compression::Coding::IDENTITY || body->size() < compression::MIN_COMPRESS_SIZE){
+        return {std::move(body)};
+    }
+    key.coding = coding;
+    SharedPayload compressed = snapshot.payloads.GetOrBuild(key, [&body, coding]() -> SharedPayload {
+        std::string data = compression::CompressIfSmaller(*body, coding, compression::DEFAULT_LEVEL);
+        if(data.empty()){
+            return nullptr;
+        }
+        return std::make_shared<const std::string>(std::move(data));
+    });
+    if(!compressed){
+        return {std::move(body)};
+    }
+    return {std::move(compressed), coding};
+}
+
+} // namespace
+
+EncodedPayload EncodedPayload::FromJson(std::string json, int level){
+    EncodedPayload payload;
+    auto& json_variants = payload.bodies[static_cast<size_t>(Format::JSON)];
+    auto& msgpack_variants = payload.bodies[static_cast<size_t>(Format::MSGPACK)];
+    json_variants[0] = std::make_shared<const std::string>(std::move(json));
+    msgpack_variants[0] = std::make_shared<const std::string>(msgpack::FromJson(*json_variants[0]));
+
+    for(auto* variants : {&json_variants, &msgpack_variants}){
+        const std::string& data = *(*variants)[0];
+        for(compression::Coding coding : {compression::Coding::GZIP, compression::Coding::DEFLATE}){
+            if(std::string compressed = compression::CompressIfSmaller(data, coding, level); !compressed.empty()){
+                (*variants)[static_cast<size_t>(coding)] = std::make_shared<const std::string>(std::move(compressed));
+            }
+        }
+    }
+
+    for(size_t format = 0; format < FORMATS_COUNT; ++format){
+        for(size_t coding = 0; coding < compression::CODINGS_COUNT; ++coding){
+            if(const SharedPayload& body = payload.bodies[format][coding]){
+                payload.etags[format][coding] = etag::MakeEtag(*body);
+            }
+        }
+    }
+    return payload;
+}
+
+SharedPayload GetFullState(const SessionSnapshot& snapshot){
+    return snapshot.payloads.GetOrBuild({PayloadKey::Document::STATE, 0, Format::JSON}, [&snapshot]{
+        return MakeFullState(*snapshot.entities);
+    });
+}
+
+SharedPayload GetStateDelta(const SessionSnapshot& snapshot, uint64_t since){
+    if(!snapshot.entities){
+        return nullptr;
+    }
+
+    const SnapshotEntities* older = since == snapshot.version ? snapshot.entities.get() : nullptr;
+    for(const EntitiesPtr& entities : snapshot.history){
+        if(older){
+            break;
+        }
+        if(entities->version == since){
+            older = entities.get();
+        }
+    }
+    if(!older){
+        return nullptr;
+    }
+
+    PayloadKey key{PayloadKey::Document::DELTA, since, Format::JSON};
+    return snapshot.payloads.GetOrBuild(key, [older, &snapshot]{
+        return MakeStateDelta(*older, *snapshot.entities);
+    });
+}
+
+EncodedBody GetStatePayload(const SnapshotPtr& snapshot, std::optional<uint64_t> since, 
+                            Format format, compression::Coding coding){
+    SharedPayload delta = since ? GetStateDelta(*snapshot, *since) : nullptr;
+    SharedPayload body = delta ? delta : GetFullState(*snapshot);
+
+    PayloadKey key = delta ? PayloadKey{PayloadKey::Document::DELTA, *since, format} 
+                           : PayloadKey{PayloadKey::Document::STATE, 0, format};
+    if(format != Format::JSON){
+        body = snapshot->payloads.GetOrBuild(key, [&body]{
+            return std::make_shared<const std::string>(msgpack::FromJson(*body));
+        });
+    }
+    return CompressOnce(*snapshot, key, std::move(body), coding);
+}
+
+EncodedBody GetPlayersPayload(const SnapshotPtr& snapshot, Format format, compression::Coding coding){
+    PayloadKey key{PayloadKey::Document::PLAYERS, 0, format};
+    SharedPayload body(snapshot, &snapshot->player_list);
+    if(format != Format::JSON){
+        body = snapshot->payloads.GetOrBuild(key, [&body]{
+            return std::make_shared<const std::string>(msgpack::FromJson(*body));
+        });
+    }
+    return CompressOnce(*snapshot, key, std::move(body), coding);
+}
+
+SharedPayload MakeStateFrame(const SessionSnapshot& snapshot){
+    /* Состояние берётся из кэша снимка и вставляется в кадр как есть */
+    SharedPayload state = GetFullState(snapshot);
+    std::string version = std::to_string(snapshot.version);
+    std::string frame;
+    frame.reserve(state->size() + version.size() + 40);
+    frame.append(R"({"type":"state","version":)").append(version)
+         .append(R"(,"state":)").append(*state).append("}");
+    return std::make_shared<const std::string>(std::move(frame));
+}
+
+SharedPayload MakePlayersFrame(const SessionSnapshot& snapshot){
+    std::string frame;
+    frame.reserve(snapshot.player_list.size() + 32);
+    frame.append(R"({"type":"players","players":)").append(snapshot.player_list).append("}");
+    return std::make_shared<const std::string>(std::move(frame));
+}
+
+/* ------------------------ SnapshotUpdate ----------------------------------- */
+
+SnapshotUpdate::SnapshotUpdate(SnapshotPtr snapshot, bool players_changed)
+    : snapshot_(std::move(snapshot))
+    , players_changed_(players_changed){
+}
+
+const SharedPayload& SnapshotUpdate::GetStateFrame() const{
+    if(!state_frame_){
+        state_frame_ = MakeStateFrame(*snapshot_);
+    }
+    return state_frame_;
+}
+
+const SharedPayload& SnapshotUpdate::GetPlayersFrame() const{
+    if(players_changed_ && !players_frame_){
+        players_frame_ = MakePlayersFrame(*snapshot_);
+    }
+    return players_frame_;
+}
+
 /* ------------------------ GetMapUseCase ----------------------------------- */
 
 std::string GetMapUseCase::MakeMapDescription(const Map* map){
@@ -203,6 +575,10 @@ std::string ListMapsUseCase::MakeMapsList(const Game::Maps& maps){
 
 /* ------------------------ GameUseCase ----------------------------------- */
 
+void GameUseCase::Reserve(size_t players_count){
+    clocks_.reserve(players_count);
+}
+
 std::string GameUseCase::JoinGame(const std::string& user_name, const std::string& str_map_id, 
                         Game& game, bool is_random_spawn_enabled){
     using namespace std::literals;
@@ -215,7 +591,7 @@ std::string GameUseCase::JoinGame(const std::string& user_name, const std::strin
 
     Dog::Name dog_name(user_name);
     Dog::Position dog_pos = (is_random_spawn_enabled) 
-        ? Dog::Position(Map::GetRandomPos(game.FindMap(map_id)->GetRoads())) 
+        ? Dog::Position(session->GetRandomPos()) 
         : Dog::Position(Map::GetFirstPos(game.FindMap(map_id)->GetRoads()));
     Dog::Speed dog_speed({0, 0});
     Direction dog_dir = Direction::NORTH;
@@ -225,8 +601,10 @@ std::string GameUseCase::JoinGame(const std::string& user_name, const std::strin
     /*
         С появлением нового игрока в сессии,
         нужно обновить количество потерянных объектов
+        и перепланировать появление трофеев
     */
-    session->UpdateLoot(session->GetDogs().size() - session->GetLootObjects().size());
+    session->UpdateLoot(session->GetLootShortage());
+    game.ScheduleLootSpawn(session);
     Player& player = players_.Add(auto_counter_, Player::Name(user_name), 
                                         dog, session);
     ++auto_counter_;
@@ -236,6 +614,19 @@ std::string GameUseCase::JoinGame(const std::string& user_name, const std::strin
         Добавляем часы для игрока
     */
     AddPlayerTimeClock(&player);
+
+    /* 
+        Токен нового игрока должен сразу находить снимок сессии,
+        поэтому первый снимок новой сессии публикуется немедленно.
+        Снимок существующей сессии отстаёт от входа не больше, 
+        чем до ближайшей публикации. Токен ждёт её же в очереди реестра
+    */
+    if(snapshots_.IsPublished(session)){
+        pending_snapshots_.insert(session);
+    } else {
+        PublishSnapshot(session, tokens_.GetPlayersBySession(session), snapshots_.NextVersion());
+    }
+    snapshots_.AddToken(token, session);
     
     json::object json_body;
     json_body["authToken"] = *token;
@@ -244,16 +635,6 @@ std::string GameUseCase::JoinGame(const std::string& user_name, const std::strin
     return json::serialize(json_body);   
 }
 
-std::string GameUseCase::GetGameState(const Token& token) const{
-    json::object result;
-    const GameSession* session = tokens_.FindPlayerByToken(token)->GetSession();
-
-    result["players"] = GetPlayers(tokens_.GetPlayersBySession(session));
-    result["lostObjects"] = GetLostObjects(session->GetLootObjects());
-
-    return json::serialize(result);
-}
-
 std::string GameUseCase::SetAction(const json::object& action, const Token& token){
     Player* player = tokens_.FindPlayerByToken(token);
     double dog_speed = player->GetSession()->GetMap()->GetDogSpeed();
@@ -298,11 +679,10 @@ std::string GameUseCase::IncreaseTime(unsigned delta, Game& game){
 
     game.UpdateGameState(delta);
 
-    return "{}";
-}
+    /* Читатели видят мир, отстающий не более чем на один тик */
+    PublishSessions();
 
-void GameUseCase::GenerateLoot(Milliseconds delta, Game& game){
-    game.GenerateLootInSessions(delta);
+    return "{}";
 }
 
 std::string GameUseCase::GetRecords(unsigned start, unsigned max_items){
@@ -320,6 +700,93 @@ std::string GameUseCase::GetRecords(unsigned start, unsigned max_items){
     return json::serialize(records);
 }
 
+SnapshotPtr GameUseCase::FindSnapshotByToken(const Token& token) const{
+    return snapshots_.FindByToken(token);
+}
+
+bool GameUseCase::SubscribeToSnapshots(const Token& token, std::weak_ptr<SnapshotSubscriber> subscriber){
+    const Player* player = tokens_.FindPlayerByToken(token);
+    if(!player){
+        return false;
+    }
+    snapshots_.Subscribe(player->GetSession(), std::move(subscriber));
+    return true;
+}
+
+void GameUseCase::PublishAllSnapshots(){
+    snapshots_.ResetTokens(tokens_.GetAllTokens());
+    PublishSessions();
+}
+
+bool GameUseCase::HasPendingSnapshots() const{
+    return !pending_snapshots_.empty() || snapshots_.HasPendingTokens();
+}
+
+void GameUseCase::PublishPendingSnapshots(){
+    snapshots_.FlushTokens();
+    if(pending_snapshots_.empty()){
+        return;
+    }
+
+    uint64_t version = snapshots_.NextVersion();
+    for(const GameSession* session : pending_snapshots_){
+        PublishSnapshot(session, tokens_.GetPlayersBySession(session), version);
+    }
+    pending_snapshots_.clear();
+}
+
+void GameUseCase::PublishSessions(){
+    uint64_t version = snapshots_.NextVersion();
+    for(const auto& [session, players] : tokens_.GetAllSessions()){
+        PublishSnapshot(session, players, version);
+    }
+    pending_snapshots_.clear();
+}
+
+void GameUseCase::PublishSnapshot(const GameSession* session, 
+                                    const PlayerTokens::PlayersInSession& players, 
+                                    uint64_t version){
+    auto entities = std::make_shared<SnapshotEntities>(GetEntities(players, session));
+    entities->version = version;
+
+    /* Полное состояние не сериализуется в strand: его построит первый запросивший */
+    auto snapshot = std::make_shared<SessionSnapshot>(&snapshots_.GetCacheStats());
+    snapshot->version = version;
+    snapshot->player_list = ListPlayersUseCase::GetPlayersInJSON(players);
+
+    /* История версий переходит от предыдущего снимка сессии со сдвигом на одну версию */
+    if(SnapshotPtr previous = snapshots_.FindBySession(session); previous && previous->entities){
+        snapshot->history.reserve(DELTA_HISTORY);
+        snapshot->history.push_back(previous->entities);
+        size_t kept = std::min(previous->history.size(), DELTA_HISTORY - 1);
+        snapshot->history.insert(snapshot->history.end(), previous->history.begin(), previous->history.begin() + kept);
+    }
+    snapshot->entities = std::move(entities);
+
+    snapshots_.Publish(session, std::move(snapshot));
+}
+
+SnapshotEntities GameUseCase::GetEntities(const PlayerTokens::PlayersInSession& players_in_session, 
+                                            const GameSession* session) const{
+    SnapshotEntities entities;
+
+    entities.players.reserve(players_in_session.size());
+    for(const Player* player : players_in_session){
+        entities.players.emplace_back(player->GetId(), json::serialize(GetPlayer(player)));
+    }
+    for(const Loot& loot : session->GetLootObjects()){
+        entities.lost_objects.emplace_back(loot.id, json::serialize(GetLostObject(loot)));
+    }
+
+    /* Упорядочение по id позволяет сравнивать версии одним проходом */
+    auto by_id = [](const SnapshotEntities::Entity& lhs, const SnapshotEntities::Entity& rhs){
+        return lhs.first < rhs.first;
+    };
+    std::sort(entities.players.begin(), entities.players.end(), by_id);
+    std::sort(entities.lost_objects.begin(), entities.lost_objects.end(), by_id);
+    return entities;
+}
+
 json::array GameUseCase::GetBagItems(const Dog::Bag& bag_items){
     json::array items;
     for(const Loot& loot : *bag_items){
@@ -333,68 +800,56 @@ json::array GameUseCase::GetBagItems(const Dog::Bag& bag_items){
     return items;
 };
 
-json::object GameUseCase::GetPlayers(const PlayerTokens::PlayersInSession& players_in_session) const{
-    json::object players;
-
-    for(const Player* player : players_in_session){
-        json::object player_attributes;
-
-        const PairDouble& pos = *(player->GetDog()->GetPosition());
-        player_attributes["pos"] = {pos.x, pos.y};
-        
-        const PairDouble& speed = *(player->GetDog()->GetSpeed());
-        player_attributes["speed"] = {speed.x, speed.y};
-
-        Direction dir = player->GetDog()->GetDirection();
-        switch (dir)
-        {
-            case Direction::NORTH:
-                player_attributes["dir"] = "U";
-                break;
-            case Direction::SOUTH:
-                player_attributes["dir"] = "D";
-                break;
-            case Direction::WEST:
-                player_attributes["dir"] = "L";
-                break;
-            case Direction::EAST:
-                player_attributes["dir"] = "R";
-                break;
-            default:
-                player_attributes["dir"] = "Unknown";
-        }
-
-        player_attributes["bag"] = GetBagItems(player->GetDog()->GetBag());
-        player_attributes["score"] = player->GetDog()->GetScore();
-        // auto time = clocks_.at(player).GetInactivityTime();
-        // if(time.has_value()){
-        //     player_attributes["retirement_time"] = time->count();
-        // } else {
-        //     json::value empty;
-        //     empty.emplace_null();
-        //     player_attributes["retirement_time"] = empty;
-        // }
+json::object GameUseCase::GetPlayer(const Player* player){
+    json::object player_attributes;
 
-        players[std::to_string(player->GetId())] = player_attributes;
+    const PairDouble& pos = *(player->GetDog()->GetPosition());
+    player_attributes["pos"] = {pos.x, pos.y};
+    
+    const PairDouble& speed = *(player->GetDog()->GetSpeed());
+    player_attributes["speed"] = {speed.x, speed.y};
+
+    Direction dir = player->GetDog()->GetDirection();
+    switch (dir)
+    {
+        case Direction::NORTH:
+            player_attributes["dir"] = "U";
+            break;
+        case Direction::SOUTH:
+            player_attributes["dir"] = "D";
+            break;
+        case Direction::WEST:
+            player_attributes["dir"] = "L";
+            break;
+        case Direction::EAST:
+            player_attributes["dir"] = "R";
+            break;
+        default:
+            player_attributes["dir"] = "Unknown";
     }
 
-    return players;
+    player_attributes["bag"] = GetBagItems(player->GetDog()->GetBag());
+    player_attributes["score"] = player->GetDog()->GetScore();
+    // auto time = clocks_.at(player).GetInactivityTime();
+    // if(time.has_value()){
+    //     player_attributes["retirement_time"] = time->count();
+    // } else {
+    //     json::value empty;
+    //     empty.emplace_null();
+    //     player_attributes["retirement_time"] = empty;
+    // }
+
+    return player_attributes;
 }
 
-json::object GameUseCase::GetLostObjects(const std::list<Loot>& loots){
-    json::object lost_objects;
-    
-    for(const Loot& loot : loots){
-        json::object loot_decs;
+json::object GameUseCase::GetLostObject(const Loot& loot){
+    json::object loot_decs;
 
-        loot_decs["type"] = loot.type;
-        json::array pos = { loot.pos.x, loot.pos.y };
-        loot_decs["pos"] = pos;
-
-        lost_objects[std::to_string(loot.id)] = loot_decs;
-    }
+    loot_decs["type"] = loot.type;
+    json::array pos = { loot.pos.x, loot.pos.y };
+    loot_decs["pos"] = pos;
 
-    return lost_objects;
+    return loot_decs;
 }
 
 void GameUseCase::AddPlayerTimeClock(Player* player){
@@ -422,6 +877,7 @@ void GameUseCase::DisconnectPlayer(const Player* player, Game& game){
     const GameSession* player_game_session = player->GetSession();
     const Dog* player_dog =  player->GetDog();
 
+    snapshots_.RemoveToken(player->GetToken());
     tokens_.DeletePlayer(player);
     auto it = clocks_.find(player);
     clocks_.erase(it);
@@ -9,9 +9,17 @@
 #include <optional>
 #include <functional>
 #include <fstream>
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <future>
+#include <vector>
+#include <unordered_set>
 #include "player.h"
 #include "model_serialization.h"
 #include "connection_pool.h"
+#include "msgpack.h"
+#include "compression.h"
 
 namespace app{
 
@@ -77,6 +85,331 @@ private:
 
 } // namespace detail
 
+/* ------------------------ SessionSnapshot ----------------------------------- */
+
+/* Неизменяемое сериализованное тело ответа, разделяемое всеми ответами с одинаковым содержимым */
+using SharedPayload = std::shared_ptr<const std::string>;
+
+/* Сколько предыдущих версий сессии хранит снимок для ответов ?since=<version> */
+inline constexpr size_t DELTA_HISTORY = 16;
+
+/*
+    Сущности снимка, сериализованные по отдельности и упорядоченные по id.
+    Разность двух версий - сущности, чей JSON изменился, и id исчезнувших
+*/
+struct SnapshotEntities{
+    using Entity = std::pair<uint64_t, std::string>;
+
+    uint64_t version = 0;
+    std::vector<Entity> players;
+    std::vector<Entity> lost_objects;
+};
+
+using EntitiesPtr = std::shared_ptr<const SnapshotEntities>;
+
+/* Формат тела ответа, выбираемый по заголовку Accept */
+enum class Format{
+    JSON,
+    MSGPACK
+};
+
+inline constexpr size_t FORMATS_COUNT = 2;
+
+/* Тело ответа и кодирование, которым оно сжато */
+struct EncodedBody{
+    SharedPayload data;
+    compression::Coding coding = compression::Coding::IDENTITY;
+    // Сильный ETag неизменяемого тела. Пуст для тел, которые меняются каждый тик
+    std::string_view etag;
+};
+
+/* Тело ответа, заранее подготовленное во всех форматах и кодированиях */
+struct EncodedPayload{
+    // Сжатого варианта нет, если тело слишком мало или плохо сжимается
+    std::array<std::array<SharedPayload, compression::CODINGS_COUNT>, FORMATS_COUNT> bodies;
+    // ETag каждого варианта: варианты с разным форматом и сжатием - разные представления
+    std::array<std::array<std::string, compression::CODINGS_COUNT>, FORMATS_COUNT> etags;
+
+    /* Готовит все варианты JSON-документа json, сжимая их с уровнем level */
+    static EncodedPayload FromJson(std::string json, int level);
+
+    /* Вариант в формате format, сжатый кодированием coding, если такой вариант есть */
+    EncodedBody Get(Format format, compression::Coding coding) const{
+        const size_t index = bodies[static_cast<size_t>(format)][static_cast<size_t>(coding)] 
+                                ? static_cast<size_t>(coding) : static_cast<size_t>(compression::Coding::IDENTITY);
+        const auto& body = bodies[static_cast<size_t>(format)][index];
+        const auto& etag = etags[static_cast<size_t>(format)][index];
+        return {body, static_cast<compression::Coding>(index), etag};
+    }
+};
+
+/* Представление снимка, которое строится по первому запросу */
+struct PayloadKey{
+    enum class Document{
+        STATE,
+        DELTA,
+        PLAYERS
+    };
+
+    Document document = Document::STATE;
+    // Версия, от которой строится разность DELTA
+    uint64_t since = 0;
+    Format format = Format::JSON;
+    compression::Coding coding = compression::Coding::IDENTITY;
+
+    bool operator==(const PayloadKey&) const = default;
+};
+
+/* Счётчики кэша представлений снимков, общие для всех сессий. Читаются эндпоинтом метрик */
+struct PayloadCacheStats{
+    // Запросы, получившие уже построенное или строящееся представление
+    std::atomic<uint64_t> hits{0};
+    // Запросы, которые строили представление сами
+    std::atomic<uint64_t> misses{0};
+};
+
+/* 
+    Представления, уже построенные для снимка. Каждое строится один раз (single-flight):
+    первый запросивший строит его без блокировки кэша, а одновременные запросы
+    того же представления дожидаются результата и не сериализуют его повторно
+*/
+class PayloadCache{
+public:
+    explicit PayloadCache(PayloadCacheStats* stats = nullptr)
+        : stats_(stats){
+    }
+
+    template<typename Build>
+    SharedPayload GetOrBuild(const PayloadKey& key, Build&& build){
+        std::unique_lock lock(mutex_);
+        for(const auto& [cached_key, cached] : payloads_){
+            if(cached_key == key){
+                std::shared_future<SharedPayload> payload = cached;
+                lock.unlock();
+                Count(&PayloadCacheStats::hits);
+                return payload.get();
+            }
+        }
+        std::promise<SharedPayload> promise;
+        payloads_.emplace_back(key, promise.get_future().share());
+        lock.unlock();
+        Count(&PayloadCacheStats::misses);
+
+        try{
+            SharedPayload payload = build();
+            promise.set_value(payload);
+            return payload;
+        } catch(...){
+            /* Ожидающие получат то же исключение, а следующий запрос построит представление заново */
+            promise.set_exception(std::current_exception());
+            std::lock_guard relock(mutex_);
+            std::erase_if(payloads_, [&key](const auto& entry){
+                return entry.first == key;
+            });
+            throw;
+        }
+    }
+private:
+    void Count(std::atomic<uint64_t> PayloadCacheStats::* counter){
+        if(stats_){
+            (stats_->*counter).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    PayloadCacheStats* stats_;
+    std::mutex mutex_;
+    std::vector<std::pair<PayloadKey, std::shared_future<SharedPayload>>> payloads_;
+};
+
+/*
+    Неизменяемый снимок состояния игровой сессии.
+    Публикуется внутри strand в конце тика,
+    а читается обработчиками запросов из любого потока
+*/
+struct SessionSnapshot{
+    explicit SessionSnapshot(PayloadCacheStats* stats = nullptr)
+        : payloads(stats){
+    }
+
+    uint64_t version = 0;
+    std::string player_list;
+    EntitiesPtr entities;
+    // Сущности предыдущих снимков сессии, от новых к старым, не больше DELTA_HISTORY
+    std::vector<EntitiesPtr> history;
+    // Полное состояние, разности, MessagePack и сжатые варианты строятся по первому запросу
+    mutable PayloadCache payloads;
+};
+
+using SnapshotPtr = std::shared_ptr<const SessionSnapshot>;
+
+/* 
+    Полное состояние сессии {"players":{...},"lostObjects":{...}}.
+    Сериализуется один раз на версию первым запросившим его клиентом или подписчиком
+*/
+SharedPayload GetFullState(const SessionSnapshot& snapshot);
+
+/* 
+    Разность состояния сессии от версии since до снимка snapshot:
+    {"since":...,"version":...,"players":{...},"removedPlayers":[...],"lostObjects":{...},"removedObjects":[...]}.
+    nullptr - версии since нет среди последних DELTA_HISTORY версий сессии
+*/
+SharedPayload GetStateDelta(const SessionSnapshot& snapshot, uint64_t since);
+
+/* 
+    Тело состояния сессии в формате format: разность от версии since, 
+    если она есть в истории снимка, иначе полное состояние.
+    Сжатый кодированием coding вариант строится один раз на снимок и разделяется всеми запросами.
+    Малые и плохо сжимаемые тела возвращаются без сжатия
+*/
+EncodedBody GetStatePayload(const SnapshotPtr& snapshot, std::optional<uint64_t> since, 
+                            Format format, compression::Coding coding);
+
+/* Тело списка игроков сессии в формате format, сжатое так же, как состояние */
+EncodedBody GetPlayersPayload(const SnapshotPtr& snapshot, Format format, compression::Coding coding);
+
+/* 
+    Кадры, рассылаемые подписчикам сессии после публикации снимка.
+    Кадр собирается при первом запросе и разделяется всеми подписчиками,
+    поэтому сессия без WebSocket-подписчиков кадры не сериализует.
+    Используется только внутри strand
+*/
+class SnapshotUpdate{
+public:
+    SnapshotUpdate(SnapshotPtr snapshot, bool players_changed);
+
+    const SnapshotPtr& GetSnapshot() const{
+        return snapshot_;
+    }
+
+    const SharedPayload& GetStateFrame() const;
+
+    /* Пустой, если список игроков не изменился */
+    const SharedPayload& GetPlayersFrame() const;
+private:
+    SnapshotPtr snapshot_;
+    bool players_changed_;
+    mutable SharedPayload state_frame_;
+    mutable SharedPayload players_frame_;
+};
+
+/* Кадр {"type":"state","version":...,"state":...} с состоянием сессии */
+SharedPayload MakeStateFrame(const SessionSnapshot& snapshot);
+
+/* Кадр {"type":"players","players":...} со списком игроков сессии */
+SharedPayload MakePlayersFrame(const SessionSnapshot& snapshot);
+
+/* 
+    Получатель снимков сессии. OnSnapshot вызывается внутри strand,
+    поэтому реализация только передаёт кадры в свой executor
+*/
+class SnapshotSubscriber{
+public:
+    virtual void OnSnapshot(const SnapshotUpdate& update) = 0;
+protected:
+    ~SnapshotSubscriber() = default;
+};
+
+namespace detail{
+
+/* ------------------------ SnapshotRegistry ----------------------------------- */
+
+/*
+    Хранилище опубликованных снимков сессий.
+    Все изменяющие методы вызываются только внутри strand,
+    FindByToken может вызываться из любого потока:
+    снимки и таблица токенов подменяются атомарно (RCU)
+*/
+class SnapshotRegistry{
+public:
+    using TokenToPlayer = PlayerTokens::TokenToPlayer;
+
+    uint64_t NextVersion();
+
+    /* Публикует снимок и рассылает его кадры подписчикам сессии */
+    void Publish(const GameSession* session, SnapshotPtr snapshot);
+
+    /* Подписывает на снимки сессии. Подписка снимается, когда подписчик уничтожен */
+    void Subscribe(const GameSession* session, std::weak_ptr<SnapshotSubscriber> subscriber);
+
+    /* Был ли для сессии опубликован хотя бы один снимок */
+    bool IsPublished(const GameSession* session) const;
+
+    /* Последний опубликованный снимок сессии. Вызывается внутри strand */
+    SnapshotPtr FindBySession(const GameSession* session) const;
+
+    /* 
+        Ставит токен в очередь на вставку. Токен сразу находится через FindByToken,
+        а в шарды переносится пачкой в FlushTokens
+    */
+    void AddToken(const Token& token, const GameSession* session);
+
+    bool HasPendingTokens() const{
+        return !pending_tokens_.empty();
+    }
+
+    /* Переносит очередь токенов в шарды: каждый затронутый шард копируется один раз на пачку */
+    void FlushTokens();
+
+    void RemoveToken(const Token& token);
+
+    void ResetTokens(const TokenToPlayer& tokens);
+
+    SnapshotPtr FindByToken(const Token& token) const;
+
+    /* Выдан ли токен игроку. Может вызываться из любого потока */
+    bool ContainsToken(const Token& token) const;
+
+    /* Счётчики кэша представлений, передаваемые каждому новому снимку */
+    PayloadCacheStats& GetCacheStats(){
+        return cache_stats_;
+    }
+
+    const PayloadCacheStats& GetCacheStats() const{
+        return cache_stats_;
+    }
+private:
+    /* 
+        Ячейка, в которой атомарно подменяется снимок одной сессии.
+        Подписчики читаются и меняются только внутри strand
+    */
+    struct Slot{
+        SnapshotPtr snapshot;
+        std::vector<std::weak_ptr<SnapshotSubscriber>> subscribers;
+    };
+
+    using SlotPtr = std::shared_ptr<Slot>;
+    using TokenToSlot = std::unordered_map<Token, SlotPtr, util::TaggedHasher<Token>>;
+    using TokenShardPtr = std::shared_ptr<const TokenToSlot>;
+
+    /* 
+        Таблица токенов разбита на шарды, 
+        чтобы вход игрока копировал только малую её часть 
+    */
+    static constexpr size_t TOKEN_SHARDS = 64;
+
+    SlotPtr GetSlot(const GameSession* session);
+
+    static void Notify(Slot& slot, SnapshotPtr snapshot, const SnapshotPtr& previous);
+
+    size_t GetShardIndex(const Token& token) const;
+
+    /* Ячейка токена: сначала из шарда, затем из очереди на вставку */
+    SlotPtr FindSlotByToken(const Token& token) const;
+
+    uint64_t version_ = 0;
+    PayloadCacheStats cache_stats_;
+    std::unordered_map<const GameSession*, SlotPtr> slots_;
+    std::array<TokenShardPtr, TOKEN_SHARDS> token_shards_;
+    /* 
+        Токены, ещё не перенесённые в шарды. Меняются только внутри strand,
+        поэтому там читаются без блокировки; другие потоки читают под pending_mutex_
+    */
+    TokenToSlot pending_tokens_;
+    mutable std::mutex pending_mutex_;
+};
+
+} // namespace detail
+
 /* ------------------------ Use Cases ----------------------------------- */
 
 /* ------------------------ GetMapUseCase ----------------------------------- */
@@ -108,22 +441,53 @@ public:
     GameUseCase(Players& players, PlayerTokens& tokens, DatabaseManagerPtr&& db_manager)
         : players_(players), tokens_(tokens), db_manager_(std::move(db_manager)){}
 
+    /* Резервирует место под ожидаемое число игроков */
+    void Reserve(size_t players_count);
+
+    /* 
+        Добавляет игрока в сессию. Снимок уже опубликованной сессии 
+        не пересобирается на каждый вход, а откладывается до PublishPendingSnapshots
+    */
     std::string JoinGame(const std::string& user_name, const std::string& str_map_id, 
                             Game& game, bool is_random_spawn_enabled);
 
-    std::string GetGameState(const Token& token) const;
+    bool HasPendingSnapshots() const;
+
+    /* 
+        Публикует снимки сессий, в которые с прошлой публикации вошли игроки,
+        и переносит их токены в таблицу реестра одной пачкой
+    */
+    void PublishPendingSnapshots();
 
     std::string SetAction(const json::object& action, const Token& token);
 
     std::string IncreaseTime(unsigned delta, Game& game);
 
-    static void GenerateLoot(Milliseconds delta, Game& game);
-
     std::string GetRecords(unsigned start, unsigned max_items);
+
+    SnapshotPtr FindSnapshotByToken(const Token& token) const;
+
+    bool IsKnownToken(const Token& token) const{
+        return snapshots_.ContainsToken(token);
+    }
+
+    const PayloadCacheStats& GetSnapshotCacheStats() const{
+        return snapshots_.GetCacheStats();
+    }
+
+    /* Подписывает на снимки сессии игрока. false - игрок с таким токеном не найден */
+    bool SubscribeToSnapshots(const Token& token, std::weak_ptr<SnapshotSubscriber> subscriber);
+
+    void PublishAllSnapshots();
 private:
+    void PublishSessions();
+    void PublishSnapshot(const GameSession* session, const PlayerTokens::PlayersInSession& players, 
+                            uint64_t version);
+    SnapshotEntities GetEntities(const PlayerTokens::PlayersInSession& players_in_session, 
+                                    const GameSession* session) const;
     static json::array GetBagItems(const Dog::Bag& bag_items);
-    json::object GetPlayers(const PlayerTokens::PlayersInSession& players_in_session) const;
-    static json::object GetLostObjects(const std::list<Loot>& loots);
+    static json::object GetPlayer(const Player* player);
+    static json::object GetLostObject(const Loot& loot);
     void AddPlayerTimeClock(Player* player);
     void SaveScore(const Player* player, Game& game);
     void DisconnectPlayer(const Player* player, Game& game);
@@ -133,6 +497,8 @@ private:
     PlayerTokens& tokens_;
     PlayerTimeClocks clocks_;
     DatabaseManagerPtr db_manager_;
+    detail::SnapshotRegistry snapshots_;
+    std::unordered_set<const GameSession*> pending_snapshots_;
 };
 
 /* ------------------------ ListPlayersUseCase ----------------------------------- */
@@ -187,15 +553,23 @@ public:
         api_strand_(api_strand),
         tick_period_(tick_period), 
         rand_spawn_(randomize_spawn_points), players_(), tokens_(), 
-        game_handler_(players_, tokens_, std::move(db_manager)), time_ticker_(), loot_ticker_(){
-            /* Перед началом работы приложения всегда генерируется начальный лут*/
-            GenerateLoot(Milliseconds{0});
+        game_handler_(players_, tokens_, std::move(db_manager)), time_ticker_(){
+            /* 
+                Карты не меняются после загрузки, поэтому их список и описания
+                сериализуются и сжимаются один раз, с наилучшим сжатием,
+                и отдаются всем клиентам без копирования
+            */
+            maps_list_ = EncodedPayload::FromJson(ListMapsUseCase::MakeMapsList(game_.GetMaps()), compression::BEST_LEVEL);
+            for(const Map& map : game_.GetMaps()){
+                map_descriptions_.emplace(&map, EncodedPayload::FromJson(GetMapUseCase::MakeMapDescription(&map), 
+                                                                         compression::BEST_LEVEL));
+            }
 
             /* 
                 Если в аргументах командной строки 
                 указан период обновления игрового состояния,
-                то создаются таймер на обновление игрового состояния 
-                и таймер на обновления лута
+                то создаётся таймер на обновление игрового состояния.
+                Трофеи генерируются внутри тика по расписанию каждой сессии
             */
             if(tick_period_.has_value()){
                 time_ticker_ = std::make_shared<detail::Ticker>(api_strand_, FromInt(*tick_period_), [this](Milliseconds delta){
@@ -203,12 +577,6 @@ public:
                 });
 
                 time_ticker_->Start();
-
-                loot_ticker_ = std::make_shared<detail::Ticker>(api_strand_, game_.GetLootGeneratePeriod(), [this](Milliseconds delta){
-                    this->GenerateLoot(delta);
-                });
-
-                loot_ticker_->Start();
             }
 
             if(state_file.has_value()){
@@ -219,8 +587,9 @@ public:
         return api_strand_;
     }
 
-    std::string GetMapsList() const{
-        return ListMapsUseCase::MakeMapsList(game_.GetMaps());
+    EncodedBody GetMapsList(Format format = Format::JSON, 
+                            compression::Coding coding = compression::Coding::IDENTITY) const{
+        return maps_list_.Get(format, coding);
     }
 
     const Map* FindMap(const Map::Id& map_id) const{
@@ -235,22 +604,56 @@ public:
         return tick_period_.has_value();
     }
 
-    std::string GetMapDescription(const Map* map) const{
-        return GetMapUseCase::MakeMapDescription(map);
+    EncodedBody GetMapDescription(const Map* map, Format format = Format::JSON, 
+                                  compression::Coding coding = compression::Coding::IDENTITY) const{
+        return map_descriptions_.at(map).Get(format, coding);
+    }
+
+    /* Подготавливает хранилища игроков к ожидаемому числу входов */
+    void ReservePlayers(size_t players_count){
+        players_.Reserve(players_count);
+        tokens_.Reserve(players_count);
+        game_handler_.Reserve(players_count);
     }
 
     std::string GetJoinGameResult(const std::string& user_name, const std::string& map_id){
-        return game_handler_.JoinGame(user_name, map_id, game_, rand_spawn_);
+        std::string result = game_handler_.JoinGame(user_name, map_id, game_, rand_spawn_);
+        /* 
+            Снимки сессий публикуются одной задачей после всех входов, 
+            уже стоящих в очереди strand: при массовом входе 
+            сессия сериализуется один раз на пачку, а не на каждого игрока
+        */
+        if(game_handler_.HasPendingSnapshots() && !publish_posted_){
+            publish_posted_ = true;
+            net::post(api_strand_, [this]{
+                publish_posted_ = false;
+                game_handler_.PublishPendingSnapshots();
+            });
+        }
+        return result;
     }
 
-    std::string GetPlayerList(const Token& token) const{
-        const GameSession* session = tokens_.FindPlayerByToken(token)->GetSession();
-        PlayerTokens::PlayersInSession players = tokens_.GetPlayersBySession(session);
-        return ListPlayersUseCase::GetPlayersInJSON(players);
+    /* Может вызываться из любого потока, не заходя в strand */
+    SnapshotPtr FindSnapshotByToken(const Token& token) const{
+        return game_handler_.FindSnapshotByToken(token);
     }
 
-    std::string GetGameState(const Token& token) const{
-        return game_handler_.GetGameState(token);
+    /* Принадлежит ли токен игроку. Может вызываться из любого потока, не заходя в strand */
+    bool IsKnownToken(const Token& token) const{
+        return game_handler_.IsKnownToken(token);
+    }
+
+    /* Попадания и промахи кэша представлений снимков, может вызываться из любого потока */
+    const PayloadCacheStats& GetSnapshotCacheStats() const{
+        return game_handler_.GetSnapshotCacheStats();
+    }
+
+    /* 
+        Подписывает на снимки сессии игрока: после каждой публикации
+        подписчик получает кадры состояния. Вызывается внутри strand
+    */
+    bool SubscribeToSnapshots(const Token& token, std::weak_ptr<SnapshotSubscriber> subscriber){
+        return game_handler_.SubscribeToSnapshots(token, std::move(subscriber));
     }
 
     void SaveState(){
@@ -279,8 +682,11 @@ public:
                         tokens_.AddPlayerWithToken(added_player, Token(player_repr.GetToken()));
                         tokens_.AddPlayerInSession(added_player, session);
                     }
+                    game_.ScheduleLootSpawn(session);
                 }
             }
+            /* Восстановленные сессии сразу доступны для чтения */
+            game_handler_.PublishAllSnapshots();
         }
     }
 
@@ -297,10 +703,6 @@ public:
         return res;
     }
 
-    void GenerateLoot(Milliseconds delta){
-        return game_handler_.GenerateLoot(delta, game_);
-    }
-
     std::string ApplyPlayerAction(const json::object& action, const Token& token){
         return game_handler_.SetAction(action, token);
     }
@@ -318,7 +720,9 @@ private:
     PlayerTokens tokens_; 
     GameUseCase game_handler_;
     std::shared_ptr<detail::Ticker> time_ticker_;
-    std::shared_ptr<detail::Ticker> loot_ticker_;
+    bool publish_posted_ = false;
+    EncodedPayload maps_list_;
+    std::unordered_map<const Map*, EncodedPayload> map_descriptions_;
 };
 
 } // namespace app
\ No newline at end of file
@@ -12,7 +12,13 @@ namespace cmd_parser{
     unsigned tick_period;
     std::string state_file;
     unsigned save_state_period;
-;
+    uint64_t random_seed;
+    unsigned max_players;
+    std::string session_engine;
+    unsigned max_loop_lag;
+    unsigned max_api_queue;
+    std::string metrics_token;
+
     desc.add_options()
         ("help,h", "produce help message")
         ("tick-period,t", po::value(&tick_period)->value_name("milliseconds"s), "set tick period")
@@ -20,7 +26,26 @@ namespace cmd_parser{
         ("www-root,w", po::value(&args.www_root)->value_name("dir"s), "set static files root")
         ("randomize-spawn-points", "spawn dogs at random positions ")
         ("state-file", po::value(&state_file)->value_name("state-file"s), "set file path, which saves a game state in procces, and restore it at startup")
-        ("save-state-period", po::value(&save_state_period)->value_name("milliseconds"s), "set period for automatic saving of game state.");
+        ("save-state-period", po::value(&save_state_period)->value_name("milliseconds"s), "set period for automatic saving of game state.")
+        ("random-seed", po::value(&random_seed)->value_name("seed"s), "set seed for reproducible spawn and loot positions")
+        ("huge-pages", "back game session memory with huge pages")
+        ("region-workers", po::value(&args.region_workers)->value_name("threads"s), "split large sessions into map regions simulated by the given number of threads")
+        ("max-players", po::value(&max_players)->value_name("count"s), "reserve player storage for the expected number of players")
+        ("reactor-per-core", "run a separate io_context and SO_REUSEPORT acceptor on each pinned thread")
+        ("session-engine", po::value(&session_engine)->value_name("callbacks|coroutines"s), "select HTTP session implementation")
+        ("max-loop-lag", po::value(&max_loop_lag)->value_name("milliseconds"s), "reject low-priority requests with 503 while the event loop lags more than this")
+        ("max-api-queue", po::value(&max_api_queue)->value_name("count"s), "reject low-priority requests with 503 while more API requests are queued")
+        ("retry-after", po::value(&args.retry_after)->value_name("seconds"s), "Retry-After value for rejected requests")
+        ("rate-limit", "limit request rate per player token and per client address for each API endpoint")
+        ("rate-limit-scale", po::value(&args.rate_limit_scale)->value_name("factor"s), "multiply built-in per-endpoint request rates and bursts by factor")
+        ("metrics-token", po::value(&metrics_token)->value_name("token"s), "serve /api/v1/metrics to requests with Authorization: Bearer <token>")
+        ("max-connections", po::value(&args.max_connections)->value_name("count"s), "limit concurrent connections, evicting the longest idle keep-alive connection when full")
+        ("max-connections-per-ip", po::value(&args.max_connections_per_ip)->value_name("count"s), "limit concurrent connections from one client address")
+        ("idle-timeout", po::value(&args.idle_timeout)->value_name("seconds"s), "close keep-alive connections idle between requests for longer")
+        ("header-timeout", po::value(&args.header_timeout)->value_name("seconds"s), "time to receive a whole request after its first byte")
+        ("write-timeout", po::value(&args.write_timeout)->value_name("seconds"s), "time to send a whole response to the client")
+        ("max-header-size", po::value(&args.max_header_size)->value_name("bytes"s), "reject requests with larger headers with 431")
+        ("max-body-size", po::value(&args.max_body_size)->value_name("bytes"s), "reject requests with larger bodies with 413");
         
     // variables_map хранит значения опций после разбора
     po::variables_map vm;
@@ -45,6 +70,52 @@ namespace cmd_parser{
         args.save_state_period = save_state_period;
     }
 
+    if (vm.contains("random-seed"s)) {
+        args.random_seed = random_seed;
+    }
+
+    if (vm.contains("max-players"s)) {
+        args.max_players = max_players;
+    }
+
+    if (vm.contains("huge-pages"s)) {
+        args.huge_pages = true;
+    }
+
+    if (vm.contains("reactor-per-core"s)) {
+        args.reactor_per_core = true;
+    }
+
+    if (vm.contains("rate-limit"s)) {
+        args.rate_limit = true;
+    }
+
+    if (!(args.rate_limit_scale > 0)) {
+        throw std::runtime_error("Rate limit scale must be positive"s);
+    }
+
+    if (vm.contains("metrics-token"s)) {
+        if (metrics_token.empty()) {
+            throw std::runtime_error("Metrics token must not be empty"s);
+        }
+        args.metrics_token = metrics_token;
+    }
+
+    if (vm.contains("max-loop-lag"s)) {
+        args.max_loop_lag = max_loop_lag;
+    }
+
+    if (vm.contains("max-api-queue"s)) {
+        args.max_api_queue = max_api_queue;
+    }
+
+    if (vm.contains("session-engine"s)) {
+        if (session_engine != "callbacks"s && session_engine != "coroutines"s) {
+            throw std::runtime_error("Unknown session engine : "s + session_engine);
+        }
+        args.coroutine_sessions = session_engine == "coroutines"s;
+    }
+
     if (!vm.contains("config-file"s)) {
         throw std::runtime_error("Config file path is not specified : Usage game_server -c <file> --w <dir>"s);
     }
@@ -14,6 +14,25 @@ struct Args {
     bool randomize_spawn_points = false;
     std::optional<std::string> state_file;
     std::optional<unsigned> save_state_period;
+    std::optional<uint64_t> random_seed;
+    bool huge_pages = false;
+    unsigned region_workers = 0;
+    std::optional<unsigned> max_players;
+    bool reactor_per_core = false;
+    bool coroutine_sessions = false;
+    std::optional<unsigned> max_loop_lag;
+    std::optional<unsigned> max_api_queue;
+    unsigned retry_after = 1;
+    bool rate_limit = false;
+    double rate_limit_scale = 1.0;
+    std::optional<std::string> metrics_token;
+    unsigned max_connections = 0;
+    unsigned max_connections_per_ip = 0;
+    unsigned idle_timeout = 30;
+    unsigned header_timeout = 10;
+    unsigned write_timeout = 30;
+    unsigned max_header_size = 8 * 1024;
+    unsigned max_body_size = 64 * 1024;
 };
 
 [[nodiscard]] std::optional<Args> ParseCommandLine(int argc, const char* const argv[]);
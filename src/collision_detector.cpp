@@ -1,5 +1,6 @@
 #include "collision_detector.h"
 #include <cassert>
+#include <tuple>
 
 namespace collision_detector {
 
@@ -42,11 +43,11 @@ std::vector<GatheringEvent> FindGatherEvents(const ItemGathererProvider& provide
     }
 
     std::sort(events.begin(), events.end(), [](const GatheringEvent& lhs, const GatheringEvent& rhs){
-        return lhs.time < rhs.time;
+        return std::tie(lhs.time, lhs.gatherer_id, lhs.item_id) < std::tie(rhs.time, rhs.gatherer_id, rhs.item_id);
     });
 
     return events;
 }
 
 
-}  // namespace collision_detector
\ No newline at end of file
+}  // namespace collision_detector
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "compression.h"
+
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace compression {
+
+using namespace std::literals;
+
+std::string_view GetName(Coding coding){
+    switch(coding){
+        case Coding::GZIP:
+            return "gzip"sv;
+        case Coding::DEFLATE:
+            return "deflate"sv;
+        default:
+            return "identity"sv;
+    }
+}
+
+std::string Compress(std::string_view data, Coding coding, int level){
+    namespace io = boost::iostreams;
+    if(coding == Coding::IDENTITY){
+        return std::string(data);
+    }
+
+    std::string result;
+    {
+        io::filtering_ostream out;
+        if(coding == Coding::GZIP){
+            out.push(io::gzip_compressor(io::gzip_params(level)));
+        } else {
+            /* deflate в HTTP - это поток в обёртке zlib (RFC 1950), а не «голый» deflate */
+            out.push(io::zlib_compressor(io::zlib_params(level)));
+        }
+        out.push(io::back_inserter(result));
+        out.write(data.data(), data.size());
+    }
+    return result;
+}
+
+std::string CompressIfSmaller(std::string_view data, Coding coding, int level){
+    if(coding == Coding::IDENTITY || data.size() < MIN_COMPRESS_SIZE){
+        return {};
+    }
+    std::string compressed = Compress(data, coding, level);
+    if(compressed.size() >= data.size() * 9 / 10){
+        return {};
+    }
+    return compressed;
+}
+
+} // namespace compression
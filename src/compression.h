@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace compression {
+
+/* Кодирования содержимого (Content-Encoding), которые умеет применять сервер */
+enum class Coding{
+    IDENTITY,
+    GZIP,
+    DEFLATE
+};
+
+inline constexpr size_t CODINGS_COUNT = 3;
+
+/* Тела меньше этого размера не сжимаются: выигрыш не окупает затрат процессора */
+inline constexpr size_t MIN_COMPRESS_SIZE = 256;
+
+/* Уровни сжатия zlib: от самого быстрого до самого плотного */
+inline constexpr int FAST_LEVEL = 1;
+inline constexpr int DEFAULT_LEVEL = 6;
+inline constexpr int BEST_LEVEL = 9;
+
+/* Название кодирования для заголовка Content-Encoding */
+std::string_view GetName(Coding coding);
+
+/* Сжимает данные кодированием coding с уровнем level. Для IDENTITY возвращает копию */
+std::string Compress(std::string_view data, Coding coding, int level);
+
+/* 
+    Сжатый вариант данных, если он заметно меньше исходного, иначе пустая строка.
+    Данные меньше MIN_COMPRESS_SIZE не сжимаются
+*/
+std::string CompressIfSmaller(std::string_view data, Coding coding, int level);
+
+} // namespace compression
@@ -0,0 +1,311 @@
+#pragma once
+// boost.beast будет использовать std::string_view вместо boost::string_view
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/intrusive/list.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace http_server {
+
+namespace net = boost::asio;
+namespace sys = boost::system;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace intrusive = boost::intrusive;
+
+/* Лимиты соединений и чтения запросов. Нулевой лимит числа соединений не проверяется */
+struct ConnectionLimits {
+    size_t max_connections = 0;
+    size_t max_connections_per_ip = 0;
+    uint32_t max_header_size = 8 * 1024;
+    uint64_t max_body_size = 64 * 1024;
+    // Сколько keep-alive соединение может простаивать между запросами
+    std::chrono::seconds idle_timeout{30};
+    // За сколько после первого байта запрос должен быть прочитан целиком
+    std::chrono::seconds header_timeout{10};
+    /*
+        За сколько ответ должен быть отправлен целиком. Отсчитывается от начала записи,
+        а не от чтения запроса: ответ long-poll может ждать тика дольше header_timeout
+    */
+    std::chrono::seconds write_timeout{30};
+};
+
+/*
+    Сколько памяти буфера чтения соединение сохраняет между запросами.
+    Буфер обычного запроса не освобождается, чтобы не выделять его заново на каждый запрос,
+    а буфер, выросший на крупном теле, возвращается
+*/
+inline constexpr size_t IDLE_BUFFER_CAPACITY = 4 * 1024;
+
+/* ------------------------ ConnectionCounter ----------------------------------- */
+
+/* Хэш адреса по его 16 байтам: адреса IPv4 приводятся к виду IPv4-mapped */
+struct AddressHasher {
+    size_t operator()(const net::ip::address& address) const noexcept {
+        auto bytes = (address.is_v4() ? net::ip::make_address_v6(net::ip::v4_mapped, address.to_v4())
+                                      : address.to_v6()).to_bytes();
+        return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+    }
+};
+
+/*
+    Счётчик открытых соединений, общий для всех acceptor сервера.
+    Вызывается только при приёме и закрытии соединения, поэтому таблица адресов
+    защищена обычным мьютексом
+*/
+class ConnectionCounter {
+public:
+    enum class Admission {
+        ACCEPTED,
+        SERVER_FULL,
+        IP_FULL
+    };
+
+    explicit ConnectionCounter(const ConnectionLimits& limits)
+        : max_connections_(limits.max_connections)
+        , max_connections_per_ip_(limits.max_connections_per_ip) {
+    }
+
+    Admission TryAcquire(const net::ip::address& address) {
+        if (max_connections_per_ip_ != 0) {
+            std::lock_guard lock(mutex_);
+            size_t& count = per_ip_[address];
+            if (count >= max_connections_per_ip_) {
+                return Admission::IP_FULL;
+            }
+            if (!AcquireGlobal()) {
+                if (count == 0) {
+                    per_ip_.erase(address);
+                }
+                return Admission::SERVER_FULL;
+            }
+            ++count;
+            return Admission::ACCEPTED;
+        }
+        return AcquireGlobal() ? Admission::ACCEPTED : Admission::SERVER_FULL;
+    }
+
+    /* Занимает место сверх общего лимита: вместо нового соединения уже закрывается простаивающее */
+    void AcquireEvicted(const net::ip::address& address) {
+        total_.fetch_add(1, std::memory_order_relaxed);
+        if (max_connections_per_ip_ != 0) {
+            std::lock_guard lock(mutex_);
+            ++per_ip_[address];
+        }
+    }
+
+    void Release(const net::ip::address& address) {
+        total_.fetch_sub(1, std::memory_order_relaxed);
+        if (max_connections_per_ip_ != 0) {
+            std::lock_guard lock(mutex_);
+            if (auto it = per_ip_.find(address); it != per_ip_.end() && --it->second == 0) {
+                per_ip_.erase(it);
+            }
+        }
+    }
+
+    size_t GetConnectionsCount() const noexcept {
+        return total_.load(std::memory_order_relaxed);
+    }
+private:
+    bool AcquireGlobal() {
+        if (total_.fetch_add(1, std::memory_order_relaxed) >= max_connections_ && max_connections_ != 0) {
+            total_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    size_t max_connections_;
+    size_t max_connections_per_ip_;
+    std::atomic<size_t> total_{0};
+    std::mutex mutex_;
+    std::unordered_map<net::ip::address, size_t, AddressHasher> per_ip_;
+};
+
+/*
+    Место соединения в ConnectionCounter, занятое при приёме соединения.
+    Освобождается вместе с владельцем: сессией HTTP или сокетом WebSocket,
+    которому сессия передала соединение
+*/
+class ConnectionSlot {
+public:
+    ConnectionSlot() = default;
+
+    ConnectionSlot(std::shared_ptr<ConnectionCounter> counter, const net::ip::address& address)
+        : counter_(std::move(counter))
+        , address_(address) {
+    }
+
+    ConnectionSlot(ConnectionSlot&& other) noexcept = default;
+
+    ConnectionSlot& operator=(ConnectionSlot&& other) noexcept {
+        if (this != &other) {
+            Release();
+            counter_ = std::move(other.counter_);
+            address_ = other.address_;
+        }
+        return *this;
+    }
+
+    ConnectionSlot(const ConnectionSlot&) = delete;
+    ConnectionSlot& operator=(const ConnectionSlot&) = delete;
+
+    ~ConnectionSlot() {
+        Release();
+    }
+
+    const net::ip::address& GetAddress() const noexcept {
+        return address_;
+    }
+private:
+    void Release() {
+        if (counter_) {
+            counter_->Release(address_);
+            counter_.reset();
+        }
+    }
+
+    std::shared_ptr<ConnectionCounter> counter_;
+    net::ip::address address_;
+};
+
+/* ------------------------ IdleReaper ----------------------------------- */
+
+/* Соединение, которое IdleReaper может закрыть, пока оно ждёт следующего запроса */
+class IdleConnection {
+public:
+    // Закрывает соединение. Вызывается из любого потока
+    virtual void CloseIdle() = 0;
+protected:
+    ~IdleConnection() = default;
+private:
+    friend class IdleReaper;
+
+    // Узел встроенного списка: постановка в очередь простаивающих не выделяет память
+    intrusive::list_member_hook<> idle_hook_;
+    std::weak_ptr<IdleConnection> self_;
+    std::chrono::steady_clock::time_point idle_since_;
+};
+
+/*
+    Простаивающие keep-alive соединения одного acceptor в порядке начала простоя (LRU).
+    Раз в REAP_PERIOD закрывает соединения, простаивающие дольше idle_timeout.
+    Когда сервер заполнен, вместо отказа новому клиенту закрывается самое давнее из них
+*/
+class IdleReaper : public std::enable_shared_from_this<IdleReaper> {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::chrono::seconds REAP_PERIOD{1};
+
+    IdleReaper(net::any_io_executor executor, Clock::duration idle_timeout)
+        : timer_(std::move(executor))
+        , idle_timeout_(idle_timeout) {
+    }
+
+    void Start() {
+        ScheduleReap();
+    }
+
+    void Add(IdleConnection& connection, std::weak_ptr<IdleConnection> self) {
+        std::lock_guard lock(mutex_);
+        if (connection.idle_hook_.is_linked()) {
+            return;
+        }
+        connection.self_ = std::move(self);
+        connection.idle_since_ = Clock::now();
+        idle_.push_back(connection);
+    }
+
+    void Remove(IdleConnection& connection) {
+        std::lock_guard lock(mutex_);
+        if (connection.idle_hook_.is_linked()) {
+            idle_.erase(idle_.iterator_to(connection));
+        }
+    }
+
+    /* Закрывает самое давнее простаивающее соединение. false - простаивающих нет */
+    bool EvictOldest() {
+        std::shared_ptr<IdleConnection> victim;
+        {
+            std::lock_guard lock(mutex_);
+            // Соединение, которое уже уничтожается, пропускается
+            while (!idle_.empty() && !victim) {
+                victim = idle_.front().self_.lock();
+                idle_.pop_front();
+            }
+        }
+        if (victim) {
+            victim->CloseIdle();
+        }
+        return victim != nullptr;
+    }
+private:
+    using IdleList = intrusive::list<IdleConnection,
+        intrusive::member_hook<IdleConnection, intrusive::list_member_hook<>, &IdleConnection::idle_hook_>>;
+
+    void ScheduleReap() {
+        timer_.expires_after(REAP_PERIOD);
+        timer_.async_wait([self = shared_from_this()](sys::error_code ec) {
+            if (!ec) {
+                self->Reap();
+                self->ScheduleReap();
+            }
+        });
+    }
+
+    void Reap() {
+        const Clock::time_point deadline = Clock::now() - idle_timeout_;
+        while (true) {
+            std::shared_ptr<IdleConnection> expired;
+            {
+                std::lock_guard lock(mutex_);
+                if (idle_.empty() || idle_.front().idle_since_ > deadline) {
+                    return;
+                }
+                expired = idle_.front().self_.lock();
+                idle_.pop_front();
+            }
+            if (expired) {
+                expired->CloseIdle();
+            }
+        }
+    }
+
+    net::steady_timer timer_;
+    Clock::duration idle_timeout_;
+    std::mutex mutex_;
+    IdleList idle_;
+};
+
+/* ------------------------ ConnectionContext ----------------------------------- */
+
+/*
+    Получатель соединения, запросившего переход на WebSocket: сессия отдаёт ему поток
+    вместе с запросом Upgrade и местом соединения в лимитах и больше соединение не обслуживает
+*/
+using UpgradeHandler = std::function<void(beast::tcp_stream&& stream, http::request<http::string_body>&& request,
+                                          ConnectionSlot&& slot)>;
+
+/* Общие для всех сессий acceptor лимиты, счётчик соединений, очередь простаивающих и получатель WebSocket */
+struct ConnectionContext {
+    ConnectionLimits limits;
+    std::shared_ptr<ConnectionCounter> counter;
+    std::shared_ptr<IdleReaper> reaper;
+    UpgradeHandler upgrade;
+};
+
+}  // namespace http_server
@@ -0,0 +1,425 @@
+#pragma once
+// boost.beast будет использовать std::string_view вместо boost::string_view
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+
+#include <utility>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include "connection_limits.h"
+#include "logger.h"
+#include "sendfile_body.h"
+
+namespace http_server {
+
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+/* ------------------------ RecyclingMemory ----------------------------------- */
+
+/*
+    Память соединения под состояния асинхронных операций и ответ, переиспользуемая от запроса к запросу.
+    Одновременно у соединения живут лишь несколько таких объектов, поэтому хватает нескольких блоков.
+    Объекты крупнее блока и объекты сверх числа блоков размещаются в куче
+*/
+class RecyclingMemory {
+public:
+    static constexpr size_t BLOCK_SIZE = 1024;
+    static constexpr size_t BLOCKS_COUNT = 4;
+
+    RecyclingMemory() = default;
+    RecyclingMemory(const RecyclingMemory&) = delete;
+    RecyclingMemory& operator=(const RecyclingMemory&) = delete;
+
+    void* Allocate(size_t size) {
+        if (size <= BLOCK_SIZE) {
+            for (size_t i = 0; i < BLOCKS_COUNT; ++i) {
+                if (!in_use_[i]) {
+                    in_use_[i] = true;
+                    return blocks_[i].data();
+                }
+            }
+        }
+        return ::operator new(size);
+    }
+
+    void Deallocate(void* pointer) {
+        for (size_t i = 0; i < BLOCKS_COUNT; ++i) {
+            if (pointer == blocks_[i].data()) {
+                in_use_[i] = false;
+                return;
+            }
+        }
+        ::operator delete(pointer);
+    }
+private:
+    struct alignas(std::max_align_t) Block : std::array<std::byte, BLOCK_SIZE> {};
+
+    std::array<Block, BLOCKS_COUNT> blocks_;
+    std::array<bool, BLOCKS_COUNT> in_use_{};
+};
+
+template <typename T>
+class RecyclingAllocator {
+public:
+    using value_type = T;
+
+    explicit RecyclingAllocator(RecyclingMemory& memory) noexcept
+        : memory_(&memory) {
+    }
+
+    template <typename U>
+    RecyclingAllocator(const RecyclingAllocator<U>& other) noexcept
+        : memory_(other.memory_) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(memory_->Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, size_t) {
+        memory_->Deallocate(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const RecyclingAllocator<U>& other) const noexcept {
+        return memory_ == other.memory_;
+    }
+private:
+    template <typename U>
+    friend class RecyclingAllocator;
+
+    RecyclingMemory* memory_;
+};
+
+/* Обработчик завершения, через который asio размещает состояние операции в памяти соединения */
+template <typename Handler>
+class RecyclingHandler {
+public:
+    using allocator_type = RecyclingAllocator<void>;
+    using executor_type = net::associated_executor_t<Handler>;
+
+    RecyclingHandler(Handler handler, RecyclingMemory& memory)
+        : handler_(std::move(handler))
+        , memory_(memory) {
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type(memory_);
+    }
+
+    executor_type get_executor() const noexcept {
+        return net::get_associated_executor(handler_);
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+private:
+    Handler handler_;
+    RecyclingMemory& memory_;
+};
+
+/* Токен завершения: оборачивает обработчик токена token в RecyclingHandler */
+template <typename Token>
+struct RecyclingToken {
+    Token token;
+    RecyclingMemory& memory;
+};
+
+}  // namespace http_server
+
+/* Раскрытие RecyclingToken: операция запускается с токеном token, а его обработчик оборачивается в RecyclingHandler */
+namespace boost::asio {
+
+template <typename Token, typename Signature>
+class async_result<http_server::RecyclingToken<Token>, Signature> {
+public:
+    using return_type = typename async_result<Token, Signature>::return_type;
+
+    template <typename Initiation, typename RawToken, typename... Args>
+    static return_type initiate(Initiation&& initiation, RawToken&& token, Args&&... args) {
+        return async_initiate<Token, Signature>(
+            [initiation = std::forward<Initiation>(initiation), &memory = token.memory]
+            (auto&& handler, auto&&... args) mutable {
+                using Handler = std::decay_t<decltype(handler)>;
+                std::move(initiation)(http_server::RecyclingHandler<Handler>(std::forward<decltype(handler)>(handler), memory),
+                                      std::forward<decltype(args)>(args)...);
+            }, token.token, std::forward<Args>(args)...);
+    }
+};
+
+}  // namespace boost::asio
+
+namespace http_server {
+
+/* ------------------------ CoroSession ----------------------------------- */
+
+/*
+    Сессия на сопрограммах asio::awaitable: чтение запроса, ожидание ответа и запись
+    идут последовательно в одной сопрограмме, без цепочки обработчиков и shared_ptr на каждый шаг.
+    Ответ и состояния операций чтения и записи размещаются в памяти соединения,
+    кадры сопрограмм asio берёт из кэша своего потока
+*/
+template <typename RequestHandler>
+class CoroSession : public IdleConnection, public std::enable_shared_from_this<CoroSession<RequestHandler>> {
+public:
+    template <typename Handler>
+    CoroSession(tcp::socket&& socket, const net::ip::address& remote_address,
+                std::shared_ptr<const ConnectionContext> context, Handler&& request_handler)
+        : stream_(std::move(socket))
+        , remote_address_(remote_address)
+        , context_(std::move(context))
+        , slot_(context_->counter, remote_address)
+        , response_ready_(stream_.get_executor())
+        , request_handler_(std::forward<Handler>(request_handler)) {
+    }
+
+    ~CoroSession() {
+        context_->reaper->Remove(*this);
+    }
+
+    CoroSession(const CoroSession&) = delete;
+    CoroSession& operator=(const CoroSession&) = delete;
+
+    void Run() {
+        // Сопрограмма выполняется в executor сокета и держит сессию живой до своего завершения
+        net::co_spawn(stream_.get_executor(), [self = this->shared_from_this()]() {
+            return self->Serve();
+        }, net::detached);
+    }
+private:
+    using HttpRequest = http::request<http::string_body>;
+    using HttpResponse = http::response<http::string_body>;
+
+    class PendingResponse {
+    public:
+        virtual ~PendingResponse() = default;
+
+        // write_timeout ограничивает запись тела, которая идёт мимо таймера stream
+        virtual net::awaitable<beast::error_code> Write(beast::tcp_stream& stream, 
+                                                        std::chrono::steady_clock::duration write_timeout) = 0;
+        virtual bool NeedEof() const = 0;
+        virtual int GetStatus() const = 0;
+        virtual std::string GetContentType() const = 0;
+    };
+
+    template <typename Body, typename Fields>
+    class PendingResponseImpl final : public PendingResponse {
+    public:
+        explicit PendingResponseImpl(http::response<Body, Fields>&& response, RecyclingMemory& memory)
+            : response_(std::move(response))
+            , serializer_(response_)
+            , memory_(memory) {
+        }
+
+        net::awaitable<beast::error_code> Write(beast::tcp_stream& stream, 
+                                                std::chrono::steady_clock::duration write_timeout) override {
+            beast::error_code ec;
+            auto token = RecyclingToken<decltype(net::redirect_error(net::use_awaitable, ec))>{
+                net::redirect_error(net::use_awaitable, ec), memory_};
+            if constexpr (std::is_same_v<Body, sendfile_body::SendfileBody>) {
+                // Заголовок пишется сериализатором, а диапазоны файла отправляются через sendfile
+                co_await http::async_write_header(stream, serializer_, token);
+                if (!ec && response_.body().IsOpen()) {
+                    // Обработчик sendfile тоже размещается в памяти сессии
+                    co_await net::async_initiate<decltype(token), void(beast::error_code, std::size_t)>(
+                        [&stream, write_timeout, this](auto handler) {
+                            sendfile_body::AsyncSendBody(stream.socket(), response_.body(), write_timeout, std::move(handler));
+                        }, token);
+                }
+            } else {
+                // Сериализатор хранится в ответе, а не создаётся операцией записи в куче
+                co_await http::async_write(stream, serializer_, token);
+            }
+            co_return ec;
+        }
+
+        bool NeedEof() const override {
+            return response_.need_eof();
+        }
+
+        int GetStatus() const override {
+            return static_cast<int>(response_.result());
+        }
+
+        std::string GetContentType() const override {
+            return std::string(response_.at(http::field::content_type));
+        }
+    private:
+        http::response<Body, Fields> response_;
+        http::response_serializer<Body, Fields> serializer_;
+        RecyclingMemory& memory_;
+    };
+
+    // Возвращает память ответа в RecyclingMemory соединения
+    struct PendingDeleter {
+        RecyclingMemory* memory;
+
+        void operator()(PendingResponse* response) const {
+            response->~PendingResponse();
+            memory->Deallocate(response);
+        }
+    };
+    using PendingPtr = std::unique_ptr<PendingResponse, PendingDeleter>;
+
+    template <typename Body, typename Fields>
+    PendingPtr MakePending(http::response<Body, Fields>&& response) {
+        using Impl = PendingResponseImpl<Body, Fields>;
+        void* memory = memory_.Allocate(sizeof(Impl));
+        return PendingPtr(new (memory) Impl(std::move(response), memory_), PendingDeleter{&memory_});
+    }
+
+    void CloseIdle() override {
+        net::dispatch(stream_.get_executor(), [self = this->shared_from_this()] {
+            // За время передачи в executor соединение могло получить новый запрос
+            if (self->waiting_) {
+                beast::error_code ec;
+                self->stream_.socket().close(ec);
+            }
+        });
+    }
+
+    /* Может вызываться из любого потока: ответ передаётся в executor сокета и будит сопрограмму */
+    template <typename Body, typename Fields>
+    void Deliver(http::response<Body, Fields>&& response) {
+        net::dispatch(stream_.get_executor(),
+                      [self = this->shared_from_this(), response = std::move(response)]() mutable {
+            self->response_ = self->MakePending(std::move(response));
+            self->response_ready_.cancel();
+        });
+    }
+
+    net::awaitable<void> Serve() {
+        using namespace std::literals;
+        beast::error_code ec;
+        // Состояния операций чтения, записи и ожидания ответа размещаются в памяти соединения
+        auto token = RecyclingToken<decltype(net::redirect_error(net::use_awaitable, ec))>{
+            net::redirect_error(net::use_awaitable, ec), memory_};
+
+        const ConnectionLimits& limits = context_->limits;
+        for (;;) {
+            if (buffer_.size() == 0) {
+                // Пока запрос не начался, соединение не держит парсера и крупного буфера, таймаут простоя отсчитывает IdleReaper
+                parser_.reset();
+                if (buffer_.capacity() > IDLE_BUFFER_CAPACITY) {
+                    buffer_.shrink_to_fit();
+                }
+                waiting_ = true;
+                context_->reaper->Add(*this, this->weak_from_this());
+                co_await stream_.socket().async_wait(tcp::socket::wait_read, token);
+                waiting_ = false;
+                context_->reaper->Remove(*this);
+                if (ec) {
+                    // operation_aborted - соединение закрыто IdleReaper
+                    if (ec != net::error::operation_aborted) {
+                        LOG_ERROR(ec.value(), ec.message(), "wait");
+                    }
+                    co_return;
+                }
+            }
+
+            // Парсер пересоздаётся на месте, буфер buffer_ с уже прочитанными данными сохраняется
+            parser_.emplace();
+            parser_->body_limit(limits.max_body_size);
+            parser_->header_limit(limits.max_header_size);
+            // С первого байта запрос должен прийти целиком за header_timeout
+            stream_.expires_after(limits.header_timeout);
+            co_await http::async_read(stream_, buffer_, *parser_, token);
+
+            if (ec == http::error::end_of_stream) {
+                // Нормальная ситуация - клиент закрыл соединение
+                break;
+            }
+            if (ec == http::error::body_limit || ec == http::error::header_limit) {
+                HttpResponse response(ec == http::error::body_limit ? http::status::payload_too_large
+                                                                    : http::status::request_header_fields_too_large, 11);
+                response.set(http::field::content_type, "text/plain"sv);
+                response.keep_alive(false);
+                response.prepare_payload();
+                stream_.expires_after(limits.write_timeout);
+                co_await http::async_write(stream_, response, token);
+                break;
+            }
+            if (ec) {
+                LOG_ERROR(ec.value(), ec.message(), "read");
+                co_return;
+            }
+
+            // Срок header_timeout касался только чтения запроса: ответ long-poll может ждать тика дольше
+            stream_.expires_never();
+            HttpRequest request = parser_->release();
+            // Адрес берётся из принятого соединения: getpeername после закрытия клиентом бросил бы исключение
+            std::string ip(remote_address_.to_string());
+            std::string url(request.target());
+            std::string method(request.method_string());
+            LOG_REQUEST_RECEIVED(ip, url, method);
+            if (context_->upgrade && beast::websocket::is_upgrade(request)) {
+                // Соединение уходит получателю WebSocket, сессия на этом заканчивается
+                context_->upgrade(std::move(stream_), std::move(request), std::move(slot_));
+                co_return;
+            }
+            response_timer_.Start();
+
+            request_handler_(std::move(request), remote_address_, [self = this->shared_from_this()](auto&& response) {
+                self->Deliver(std::move(response));
+            });
+
+            // Ответ на файлы готов сразу, ответ API приходит из strand игры
+            if (!response_) {
+                response_ready_.expires_at(net::steady_timer::time_point::max());
+                co_await response_ready_.async_wait(token);
+            }
+
+            stream_.expires_after(limits.write_timeout);
+            ec = co_await response_->Write(stream_, limits.write_timeout);
+            PendingPtr response = std::move(response_);
+            if (ec) {
+                LOG_ERROR(ec.value(), ec.message(), "write");
+                co_return;
+            }
+            LOG_RESPONSE_SENT(ip, response_timer_.End(), response->GetStatus(), response->GetContentType());
+
+            if (response->NeedEof()) {
+                // Семантика ответа требует закрыть соединение
+                break;
+            }
+        }
+
+        stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+    }
+
+    // tcp_stream содержит внутри себя сокет и добавляет поддержку таймаутов
+    beast::tcp_stream stream_;
+    net::ip::address remote_address_;
+    std::shared_ptr<const ConnectionContext> context_;
+    // Место в лимитах соединений: при переходе на WebSocket уходит вместе с потоком
+    ConnectionSlot slot_;
+    beast::flat_buffer buffer_;
+    std::optional<http::request_parser<http::string_body>> parser_;
+    // Таймер без срока служит событием «ответ готов»: Deliver отменяет ожидание
+    net::steady_timer response_ready_;
+    RecyclingMemory memory_;
+    PendingPtr response_{nullptr, PendingDeleter{&memory_}};
+    logger::Timer response_timer_;
+    RequestHandler request_handler_;
+    // Сопрограмма ждёт первого байта следующего запроса
+    bool waiting_ = false;
+};
+
+}  // namespace http_server
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace etag {
+
+/* FNV-1a по содержимому: одинаковые данные дают одинаковый хеш и после перезапуска */
+inline uint64_t HashContent(std::string_view data){
+    uint64_t hash = 14695981039346656037ull;
+    for(char c : data){
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Сильный ETag по хешу содержимого и его размеру: "<hash>-<size>" */
+inline std::string MakeEtag(std::string_view data, uint64_t hash){
+    std::array<char, 40> buffer;
+    char* end = buffer.data();
+    *end++ = '"';
+    end = std::to_chars(end, buffer.data() + buffer.size(), hash, 16).ptr;
+    *end++ = '-';
+    end = std::to_chars(end, buffer.data() + buffer.size(), data.size(), 16).ptr;
+    *end++ = '"';
+    return std::string(buffer.data(), end);
+}
+
+inline std::string MakeEtag(std::string_view data){
+    return MakeEtag(data, HashContent(data));
+}
+
+} // namespace etag
@@ -0,0 +1,234 @@
+#include "game_socket.h"
+#include "logger.h"
+
+namespace game_socket {
+
+using namespace std::literals;
+
+/* ------------------------ TokenSockets ----------------------------------- */
+
+bool TokenSockets::TryAcquire(const app::Token& token){
+    std::lock_guard lock(mutex_);
+    size_t& count = sockets_[token];
+    if(count >= max_per_token_){
+        return false;
+    }
+    ++count;
+    return true;
+}
+
+void TokenSockets::Release(const app::Token& token){
+    std::lock_guard lock(mutex_);
+    if(auto it = sockets_.find(token); it != sockets_.end() && --it->second == 0){
+        sockets_.erase(it);
+    }
+}
+
+/* ------------------------ GameSocket ----------------------------------- */
+
+GameSocket::GameSocket(beast::tcp_stream&& stream, http_server::ConnectionSlot&& slot, 
+                       app::Application& app, std::shared_ptr<TokenSockets> token_sockets)
+    : ws_(std::move(stream))
+    , slot_(std::move(slot))
+    , app_(app)
+    , token_sockets_(std::move(token_sockets))
+    , auth_timer_(ws_.get_executor()){
+}
+
+GameSocket::~GameSocket(){
+    if(counted_token_){
+        token_sockets_->Release(*counted_token_);
+    }
+}
+
+void GameSocket::Run(http::request<http::string_body>&& upgrade){
+    /*
+        Таймауты WebSocket заменяют таймаут tcp_stream:
+        простаивающий клиент проверяется ping и отключается, если не отвечает
+    */
+    beast::get_lowest_layer(ws_).expires_never();
+    ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+    ws_.read_message_max(MAX_MESSAGE_SIZE);
+
+    auth_timer_.expires_after(AUTH_TIMEOUT);
+    auth_timer_.async_wait(beast::bind_front_handler(&GameSocket::OnAuthTimeout, shared_from_this()));
+    ws_.async_accept(upgrade, beast::bind_front_handler(&GameSocket::OnAccept, shared_from_this()));
+}
+
+void GameSocket::OnSnapshot(const app::SnapshotUpdate& update){
+    net::post(ws_.get_executor(), [self = shared_from_this(),
+                                   state_frame = update.GetStateFrame(),
+                                   players_frame = update.GetPlayersFrame()]() mutable {
+        self->Push(std::move(state_frame), std::move(players_frame));
+    });
+}
+
+void GameSocket::OnAccept(beast::error_code ec){
+    if(ec){
+        auth_timer_.cancel();
+        LOG_ERROR(ec.value(), ec.message(), "websocket accept");
+        return;
+    }
+    Read();
+}
+
+void GameSocket::OnAuthTimeout(beast::error_code ec){
+    /* Соединение без токена не занимает сервер дольше AUTH_TIMEOUT */
+    if(!ec && !token_){
+        closing_ = true;
+        beast::get_lowest_layer(ws_).close();
+    }
+}
+
+void GameSocket::Read(){
+    ws_.async_read(buffer_, beast::bind_front_handler(&GameSocket::OnRead, shared_from_this()));
+}
+
+void GameSocket::OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read){
+    if(ec){
+        closing_ = true;
+        auth_timer_.cancel();
+        if(ec != websocket::error::closed && ec != net::error::operation_aborted){
+            LOG_ERROR(ec.value(), ec.message(), "websocket read");
+        }
+        return;
+    }
+
+    json::object message;
+    try{
+        message = json::parse(beast::buffers_to_string(buffer_.data())).as_object();
+    } catch(const std::exception&){
+        buffer_.consume(buffer_.size());
+        return Close(websocket::close_code::bad_payload);
+    }
+    buffer_.consume(buffer_.size());
+
+    if(!token_){
+        auto it = message.find("token");
+        if(it == message.end() || !it->value().is_string()){
+            return Close(websocket::close_code::policy_error);
+        }
+        /* Следующий кадр читается после проверки токена */
+        return Authorize(app::Token(std::string(it->value().as_string())));
+    }
+
+    if(auto it = message.find("move"); it != message.end() && it->value().is_string()){
+        ApplyAction(std::move(message));
+    }
+    Read();
+}
+
+void GameSocket::Authorize(app::Token token){
+    net::dispatch(app_.GetStrand(), [self = shared_from_this(), token = std::move(token)]() mutable {
+        if(!self->app_.FindPlayerByToken(token)){
+            return net::post(self->ws_.get_executor(), [self]{
+                self->Close(websocket::close_code::policy_error);
+            });
+        }
+        /* Место занимает только настоящий игрок: случайные токены не вытесняют чужие сокеты */
+        if(!self->token_sockets_->TryAcquire(token)){
+            return net::post(self->ws_.get_executor(), [self]{
+                self->Close(websocket::close_code::try_again_later);
+            });
+        }
+        self->counted_token_ = token;
+        self->app_.SubscribeToSnapshots(token, self->weak_from_this());
+        /*
+            Текущий снимок берётся внутри strand сразу после подписки:
+            следующие снимки придут в сокет уже после него
+        */
+        app::SnapshotPtr snapshot = self->app_.FindSnapshotByToken(token);
+        net::post(self->ws_.get_executor(), [self, token = std::move(token), snapshot = std::move(snapshot)]() mutable {
+            self->token_ = std::move(token);
+            self->OnAuthorized(std::move(snapshot));
+        });
+    });
+}
+
+void GameSocket::OnAuthorized(app::SnapshotPtr snapshot){
+    auth_timer_.cancel();
+    if(closing_){
+        return;
+    }
+    if(snapshot){
+        Push(app::MakeStateFrame(*snapshot), app::MakePlayersFrame(*snapshot));
+    }
+    Read();
+}
+
+void GameSocket::ApplyAction(json::object action){
+    net::dispatch(app_.GetStrand(), [self = shared_from_this(), token = *token_, action = std::move(action)]{
+        /* Игрок мог быть отключён за бездействие, пока сокет оставался открытым */
+        if(!self->app_.FindPlayerByToken(token)){
+            return net::post(self->ws_.get_executor(), [self]{
+                self->Close(websocket::close_code::policy_error);
+            });
+        }
+        self->app_.ApplyPlayerAction(action, token);
+    });
+}
+
+void GameSocket::Push(app::SharedPayload state_frame, app::SharedPayload players_frame){
+    if(closing_){
+        return;
+    }
+    if(players_frame){
+        pending_players_.push_back(std::move(players_frame));
+    }
+    if(state_frame){
+        pending_state_ = std::move(state_frame);
+    }
+    if(!writing_frame_){
+        Write();
+    }
+}
+
+void GameSocket::Write(){
+    /* Список игроков отправляется раньше состояния, в котором эти игроки уже есть */
+    if(!pending_players_.empty()){
+        writing_frame_ = std::move(pending_players_.front());
+        pending_players_.pop_front();
+    } else if(pending_state_){
+        writing_frame_ = std::move(pending_state_);
+        pending_state_.reset();
+    } else {
+        return;
+    }
+
+    ws_.text(true);
+    ws_.async_write(net::buffer(*writing_frame_),
+                    beast::bind_front_handler(&GameSocket::OnWrite, shared_from_this()));
+}
+
+void GameSocket::OnWrite(beast::error_code ec, [[maybe_unused]] std::size_t bytes_written){
+    writing_frame_.reset();
+    if(ec){
+        closing_ = true;
+        pending_players_.clear();
+        pending_state_.reset();
+        if(ec != websocket::error::closed && ec != net::error::operation_aborted){
+            LOG_ERROR(ec.value(), ec.message(), "websocket write");
+        }
+        return;
+    }
+    if(!closing_){
+        Write();
+    }
+}
+
+void GameSocket::Close(websocket::close_code code){
+    if(closing_){
+        return;
+    }
+    closing_ = true;
+    pending_players_.clear();
+    pending_state_.reset();
+    if(writing_frame_){
+        /* Закрывающий кадр нельзя отправить, пока пишется другой: соединение просто разрывается */
+        beast::get_lowest_layer(ws_).close();
+        return;
+    }
+    ws_.async_close(code, [self = shared_from_this()](beast::error_code){});
+}
+
+} // namespace game_socket
@@ -0,0 +1,123 @@
+#pragma once
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include "app.h"
+#include "connection_limits.h"
+
+namespace game_socket {
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+namespace json = boost::json;
+
+/* ------------------------ TokenSockets ----------------------------------- */
+
+/*
+    Число открытых сокетов каждого игрока, общее для всех соединений сервера.
+    Не даёт одному токену держать сколько угодно долгоживущих соединений
+*/
+class TokenSockets{
+public:
+    explicit TokenSockets(size_t max_per_token)
+        : max_per_token_(max_per_token){
+    }
+
+    /* Занимает место сокета токена. false - у токена уже max_per_token сокетов */
+    bool TryAcquire(const app::Token& token);
+
+    void Release(const app::Token& token);
+private:
+    size_t max_per_token_;
+    std::mutex mutex_;
+    std::unordered_map<app::Token, size_t, util::TaggedHasher<app::Token>> sockets_;
+};
+
+/* ------------------------ GameSocket ----------------------------------- */
+
+/*
+    WebSocket-канал игрока: вместо опроса /state и /players
+    сервер сам присылает состояние сессии после каждого тика.
+    Браузер не может задать заголовок Authorization для WebSocket,
+    поэтому первым кадром клиент присылает {"token": "..."}.
+    Затем клиент шлёт действия {"move": "L"} в том же сокете,
+    а сервер - кадры {"type":"state",...} и, при изменении состава, {"type":"players",...}.
+    Все методы, кроме OnSnapshot, выполняются в executor сокета
+*/
+class GameSocket : public app::SnapshotSubscriber, public std::enable_shared_from_this<GameSocket>{
+public:
+    // За сколько после установки соединения клиент должен прислать токен
+    static constexpr std::chrono::seconds AUTH_TIMEOUT{10};
+    // Кадры клиента - токен и действия, крупнее им быть незачем
+    static constexpr size_t MAX_MESSAGE_SIZE = 1024;
+
+    // Сколько сокетов одновременно может держать один игрок: например, несколько вкладок
+    static constexpr size_t MAX_SOCKETS_PER_TOKEN = 4;
+
+    /* 
+        Сокет владеет местом соединения slot в лимитах сервера до своего закрытия.
+        token_sockets ограничивает число сокетов одного игрока
+    */
+    GameSocket(beast::tcp_stream&& stream, http_server::ConnectionSlot&& slot, 
+               app::Application& app, std::shared_ptr<TokenSockets> token_sockets);
+
+    ~GameSocket();
+
+    /* Завершает рукопожатие WebSocket по запросу на переход upgrade */
+    void Run(http::request<http::string_body>&& upgrade);
+
+    /* Вызывается внутри strand: кадры передаются в executor сокета */
+    void OnSnapshot(const app::SnapshotUpdate& update) override;
+private:
+    void OnAccept(beast::error_code ec);
+
+    void OnAuthTimeout(beast::error_code ec);
+
+    void Read();
+
+    void OnRead(beast::error_code ec, std::size_t bytes_read);
+
+    void Authorize(app::Token token);
+
+    void OnAuthorized(app::SnapshotPtr snapshot);
+
+    void ApplyAction(json::object action);
+
+    void Push(app::SharedPayload state_frame, app::SharedPayload players_frame);
+
+    void Write();
+
+    void OnWrite(beast::error_code ec, std::size_t bytes_written);
+
+    void Close(websocket::close_code code);
+
+    websocket::stream<beast::tcp_stream> ws_;
+    http_server::ConnectionSlot slot_;
+    app::Application& app_;
+    std::shared_ptr<TokenSockets> token_sockets_;
+    // Токен, занявший место в token_sockets_. Записывается в strand до начала чтения кадров
+    std::optional<app::Token> counted_token_;
+    net::steady_timer auth_timer_;
+    beast::flat_buffer buffer_;
+    std::optional<app::Token> token_;
+    /*
+        Медленному клиенту нужен только последний кадр состояния:
+        новый кадр вытесняет ещё не отправленный. Кадры списка игроков не теряются
+    */
+    app::SharedPayload pending_state_;
+    std::deque<app::SharedPayload> pending_players_;
+    // Отправляемый кадр удерживается до окончания записи
+    app::SharedPayload writing_frame_;
+    bool closing_ = false;
+};
+
+} // namespace game_socket
@@ -7,8 +7,16 @@
 #include <boost/asio/strand.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <array>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <vector>
 #include "logger.h"
+#include "sendfile_body.h"
+#include "connection_limits.h"
+#include "coro_session.h"
 
 namespace http_server {
 
@@ -23,7 +31,7 @@ inline void ReportError(beast::error_code ec, std::string_view what){
     LOG_ERROR(ec.value(), ec.message(), what);
 }
 
-class SessionBase {
+class SessionBase : public IdleConnection {
 public:
     // Запрещаем копирование и присваивание объектов SessionBase и его наследников
     SessionBase(const SessionBase&) = delete;
@@ -38,71 +46,304 @@ protected:
     using HttpRequest = http::request<http::string_body>;
     using HttpResponse = http::response<http::string_body>;
 
-    explicit SessionBase(tcp::socket&& socket)
-        : stream_(std::move(socket)) {
+    // Сколько запросов одного соединения может одновременно ожидать ответа
+    static constexpr uint64_t PIPELINE_LIMIT = 16;
+
+    SessionBase(tcp::socket&& socket, const net::ip::address& remote_address,
+                std::shared_ptr<const ConnectionContext> context)
+        : stream_(std::move(socket))
+        , remote_address_(remote_address)
+        , context_(std::move(context))
+        , slot_(context_->counter, remote_address) {
     }
 
-    template <typename Body, typename Fields>
-    void Write(http::response<Body, Fields>&& response) {
-        // Запись выполняется асинхронно, поэтому response перемещаем в область кучи
-        auto safe_response = std::make_shared<http::response<Body, Fields>>(std::move(response));
+    ~SessionBase() {
+        context_->reaper->Remove(*this);
+    }
 
-        auto self = GetSharedThis();
-        http::async_write(stream_, *safe_response,
-                          [safe_response, self](beast::error_code ec, std::size_t bytes_written) {
-                              self->OnWrite(safe_response, ec, bytes_written);
-                          });
+    // Адрес клиента передаётся обработчику запросов вместе с каждым запросом
+    const net::ip::address& GetRemoteAddress() const noexcept {
+        return remote_address_;
+    }
+
+    /*
+        Ставит ответ на запрос с номером sequence в очередь отправки.
+        Ответы отправляются строго в порядке запросов, даже если готовы в другом порядке.
+        Может вызываться из любого потока: очередь обслуживается в executor сокета
+    */
+    template <typename Body, typename Fields>
+    void Write(http::response<Body, Fields>&& response, uint64_t sequence) {
+        net::dispatch(stream_.get_executor(),
+                      [self = GetSharedThis(), response = std::move(response), sequence]() mutable {
+            self->Enqueue(self->MakePending(std::move(response)), sequence);
+        });
     }
 
-    ~SessionBase() = default;
 private:
+    // Ответ, ожидающий отправки. Тип тела стирается, чтобы ответы разных типов стояли в одной очереди
+    class PendingResponse {
+    public:
+        virtual ~PendingResponse() = default;
+
+        virtual void Send(const std::shared_ptr<SessionBase>& session) = 0;
+        virtual bool NeedEof() const = 0;
+        virtual int GetStatus() const = 0;
+        virtual std::string GetContentType() const = 0;
+    };
+
+    template <typename Body, typename Fields>
+    class PendingResponseImpl final : public PendingResponse {
+    public:
+        using Response = http::response<Body, Fields>;
+
+        explicit PendingResponseImpl(Response&& response)
+            : response_(std::move(response)) {
+        }
+
+        void Reset(Response&& response) {
+            serializer_.reset();
+            response_ = std::move(response);
+        }
+
+        void Send(const std::shared_ptr<SessionBase>& session) override {
+            serializer_.emplace(response_);
+            if constexpr (std::is_same_v<Body, sendfile_body::SendfileBody>) {
+                // Заголовок пишется сериализатором, а диапазоны файла отправляются через sendfile
+                // без копирования в пользовательское пространство
+                http::async_write_header(session->stream_, *serializer_,
+                                         [this, session](beast::error_code ec, std::size_t bytes_written) {
+                    if (ec || !response_.body().IsOpen()) {
+                        return session->OnWrite(ec, bytes_written);
+                    }
+                    sendfile_body::AsyncSendBody(session->stream_.socket(), response_.body(),
+                                                 session->context_->limits.write_timeout,
+                                                 [session](beast::error_code ec, std::size_t bytes_sent) {
+                        session->OnWrite(ec, bytes_sent);
+                    });
+                });
+            } else {
+                http::async_write(session->stream_, *serializer_,
+                                  [session](beast::error_code ec, std::size_t bytes_written) {
+                    session->OnWrite(ec, bytes_written);
+                });
+            }
+        }
+
+        bool NeedEof() const override {
+            return response_.need_eof();
+        }
+
+        int GetStatus() const override {
+            return static_cast<int>(response_.result());
+        }
+
+        std::string GetContentType() const override {
+            return std::string(response_.at(http::field::content_type));
+        }
+    private:
+        Response response_;
+        std::optional<http::response_serializer<Body, Fields>> serializer_;
+    };
+
+    // Строковые ответы API самые частые, их обёртки переиспользуются
+    using PendingStringResponse = PendingResponseImpl<http::string_body, http::fields>;
+
+    struct Slot {
+        std::unique_ptr<PendingResponse> response;
+        logger::Timer timer;
+    };
+
+    template <typename Body, typename Fields>
+    std::unique_ptr<PendingResponse> MakePending(http::response<Body, Fields>&& response) {
+        if constexpr (std::is_same_v<http::response<Body, Fields>, HttpResponse>) {
+            if (!string_responses_pool_.empty()) {
+                std::unique_ptr<PendingStringResponse> pending = std::move(string_responses_pool_.back());
+                string_responses_pool_.pop_back();
+                pending->Reset(std::move(response));
+                return pending;
+            }
+        }
+        return std::make_unique<PendingResponseImpl<Body, Fields>>(std::move(response));
+    }
+
+    void Recycle(std::unique_ptr<PendingResponse>&& pending) {
+        if (auto* string_response = dynamic_cast<PendingStringResponse*>(pending.get());
+                string_response && string_responses_pool_.size() < PIPELINE_LIMIT) {
+            pending.release();
+            string_responses_pool_.emplace_back(string_response);
+        }
+    }
+
     void Read() {
         using namespace std::literals;
-        // Очищаем запрос от прежнего значения (метод Read может быть вызван несколько раз)
-        request_ = {};
-        stream_.expires_after(30s);
-        // Считываем request_ из stream_, используя buffer_ для хранения считанных данных
-        http::async_read(stream_, buffer_, request_,
+        // Новые запросы не читаются, если очередь ответов заполнена или соединение закрывается
+        if (reading_ || closing_ || next_request_ - next_response_ >= PIPELINE_LIMIT) {
+            return;
+        }
+        reading_ = true;
+
+        if (buffer_.size() != 0) {
+            // Следующий запрос уже начал приходить вместе с предыдущим
+            return ReadRequest();
+        }
+        /*
+            Пока запрос не начался, соединение не держит парсера и крупного буфера:
+            ожидание готовности сокета не занимает память под данные.
+            Таймаут простоя отсчитывает IdleReaper
+        */
+        parser_.reset();
+        if (buffer_.capacity() > IDLE_BUFFER_CAPACITY) {
+            buffer_.shrink_to_fit();
+        }
+        waiting_ = true;
+        MarkIdleIfDone();
+        stream_.socket().async_wait(tcp::socket::wait_read,
+                                    beast::bind_front_handler(&SessionBase::OnReadable, GetSharedThis()));
+    }
+
+    void OnReadable(beast::error_code ec) {
+        using namespace std::literals;
+        waiting_ = false;
+        context_->reaper->Remove(*this);
+        if (ec) {
+            reading_ = false;
+            // operation_aborted - соединение закрыто IdleReaper
+            if (ec != net::error::operation_aborted) {
+                ReportError(ec, "wait"sv);
+            }
+            return;
+        }
+        ReadRequest();
+    }
+
+    void ReadRequest() {
+        const ConnectionLimits& limits = context_->limits;
+        // Парсер пересоздаётся на месте, буфер buffer_ с уже прочитанными данными сохраняется
+        parser_.emplace();
+        parser_->body_limit(limits.max_body_size);
+        parser_->header_limit(limits.max_header_size);
+        // С первого байта запрос должен прийти целиком за header_timeout: медленный клиент не держит соединение
+        stream_.expires_after(limits.header_timeout);
+        // Считываем запрос из stream_, используя buffer_ для хранения считанных данных
+        http::async_read(stream_, buffer_, *parser_,
                          // По окончании операции будет вызван метод OnRead
                          beast::bind_front_handler(&SessionBase::OnRead, GetSharedThis()));
     }
 
+    // Соединение простаивает, если ждёт нового запроса и не должно ответов
+    void MarkIdleIfDone() {
+        if (waiting_ && next_request_ == next_response_) {
+            context_->reaper->Add(*this, GetSharedThis());
+        }
+    }
+
+    void CloseIdle() override {
+        net::dispatch(stream_.get_executor(), [self = GetSharedThis()] {
+            // За время передачи в executor соединение могло получить новый запрос
+            if (self->waiting_ && self->next_request_ == self->next_response_) {
+                beast::error_code ec;
+                self->stream_.socket().close(ec);
+            }
+        });
+    }
+
     void OnRead(beast::error_code ec, [[maybe_unused]] std::size_t bytes_read) {
         using namespace std::literals;
+        reading_ = false;
         if (ec == http::error::end_of_stream) {
-            // Нормальная ситуация - клиент закрыл соединение
-            return Close();
+            // Нормальная ситуация - клиент закрыл соединение. Ответы на прочитанные запросы ещё отправляются
+            closing_ = true;
+            return CloseIfDone();
+        }
+        if (ec == http::error::body_limit || ec == http::error::header_limit) {
+            // Ответ об ошибке занимает место в очереди наравне с остальными, после него соединение закрывается
+            closing_ = true;
+            HttpResponse response(ec == http::error::body_limit ? http::status::payload_too_large
+                                                                : http::status::request_header_fields_too_large, 11);
+            response.set(http::field::content_type, "text/plain"sv);
+            response.keep_alive(false);
+            response.prepare_payload();
+            uint64_t sequence = next_request_++;
+            slots_[sequence % PIPELINE_LIMIT].timer.Start();
+            return Enqueue(MakePending(std::move(response)), sequence);
         }
         if (ec) {
-            LOG_ERROR(ec.value(), ec.message(), "read");
             return ReportError(ec, "read"sv);
         }
-        std::string ip(stream_.socket().remote_endpoint().address().to_string());
-        std::string url(request_.target());
-        std::string method(request_.method_string());
+
+        // Срок header_timeout касался только чтения запроса, срок записи ставится перед каждым ответом
+        stream_.expires_never();
+        HttpRequest request = parser_->release();
+        // Адрес берётся из принятого соединения: getpeername после закрытия клиентом бросил бы исключение
+        std::string ip(remote_address_.to_string());
+        std::string url(request.target());
+        std::string method(request.method_string());
         LOG_REQUEST_RECEIVED(ip, url, method);
-        response_timer_.Start();
-        HandleRequest(std::move(request_));
+
+        // Переход на WebSocket возможен, только если соединение никому не должно ответов
+        if (context_->upgrade && beast::websocket::is_upgrade(request) && next_request_ == next_response_) {
+            closing_ = true;
+            return context_->upgrade(std::move(stream_), std::move(request), std::move(slot_));
+        }
+
+        uint64_t sequence = next_request_++;
+        slots_[sequence % PIPELINE_LIMIT].timer.Start();
+        if (!request.keep_alive()) {
+            closing_ = true;
+        }
+        HandleRequest(std::move(request), sequence);
+
+        // Следующий запрос читается, не дожидаясь ответа на текущий
+        Read();
     }
 
-    template <typename Body, typename Fields>
-    void OnWrite(std::shared_ptr<http::response<Body, Fields>> safe_response, beast::error_code ec, [[maybe_unused]] std::size_t bytes_written) {
+    void Enqueue(std::unique_ptr<PendingResponse>&& response, uint64_t sequence) {
+        slots_[sequence % PIPELINE_LIMIT].response = std::move(response);
+        SendNext();
+    }
+
+    void SendNext() {
+        Slot& slot = slots_[next_response_ % PIPELINE_LIMIT];
+        if (writing_ || next_response_ == next_request_ || !slot.response) {
+            return;
+        }
+        writing_ = true;
+        // Таймер чтения, если следующий запрос уже читается, не меняется: tcp_stream не трогает ожидающие операции
+        stream_.expires_after(context_->limits.write_timeout);
+        slot.response->Send(GetSharedThis());
+    }
+
+    void OnWrite(beast::error_code ec, [[maybe_unused]] std::size_t bytes_written) {
         using namespace std::literals;
+        writing_ = false;
+        Slot& slot = slots_[next_response_ % PIPELINE_LIMIT];
+        std::unique_ptr<PendingResponse> response = std::move(slot.response);
+        ++next_response_;
+
         if (ec) {
-            LOG_ERROR(ec.value(), ec.message(), "write");
             return ReportError(ec, "write"sv);
         }
 
-        if (safe_response->need_eof()) {
+        std::string ip(remote_address_.to_string());
+        LOG_RESPONSE_SENT(ip, slot.timer.End(), response->GetStatus(), response->GetContentType());
+
+        if (response->NeedEof()) {
             // Семантика ответа требует закрыть соединение
             return Close();
         }
-        std::string ip(stream_.socket().remote_endpoint().address().to_string());
-        std::string content_type(safe_response->at(http::field::content_type));
-        LOG_RESPONSE_SENT(ip, response_timer_.End(), static_cast<int>(safe_response->result()), content_type);
+        Recycle(std::move(response));
 
-        // Считываем следующий запрос
+        SendNext();
+        MarkIdleIfDone();
+        // В очереди освободилось место - можно читать следующий запрос
         Read();
+        CloseIfDone();
+    }
+
+    void CloseIfDone() {
+        if (closing_ && !reading_ && !writing_ && next_response_ == next_request_) {
+            Close();
+        }
     }
 
     void Close() {
@@ -111,32 +352,48 @@ private:
         ReportError(ec, "close");
     }
 
-    // Обработку запроса делегируем подклассу
-    virtual void HandleRequest(HttpRequest&& request) = 0;
+    // Обработку запроса делегируем подклассу. Ответ передаётся в Write с тем же номером sequence
+    virtual void HandleRequest(HttpRequest&& request, uint64_t sequence) = 0;
 
     virtual std::shared_ptr<SessionBase> GetSharedThis() = 0;
     // tcp_stream содержит внутри себя сокет и добавляет поддержку таймаутов
     beast::tcp_stream stream_;
+    net::ip::address remote_address_;
+    std::shared_ptr<const ConnectionContext> context_;
+    // Место в лимитах соединений: при переходе на WebSocket уходит вместе с потоком
+    ConnectionSlot slot_;
     beast::flat_buffer buffer_;
-    HttpRequest request_;
-    logger::Timer response_timer_;
+    std::optional<http::request_parser<http::string_body>> parser_;
+
+    // Кольцо ответов, индексируется номером запроса по модулю PIPELINE_LIMIT
+    std::array<Slot, PIPELINE_LIMIT> slots_;
+    std::vector<std::unique_ptr<PendingStringResponse>> string_responses_pool_;
+    // Номер следующего прочитанного запроса и номер следующего отправляемого ответа
+    uint64_t next_request_ = 0;
+    uint64_t next_response_ = 0;
+    bool reading_ = false;
+    bool writing_ = false;
+    bool closing_ = false;
+    // Сессия ждёт первого байта следующего запроса
+    bool waiting_ = false;
 };
 
 template <typename RequestHandler>
 class Session : public SessionBase, public std::enable_shared_from_this<Session<RequestHandler>> {
 public:
     template <typename Handler>
-    Session(tcp::socket&& socket, Handler&& request_handler)
-        : SessionBase(std::move(socket))
+    Session(tcp::socket&& socket, const net::ip::address& remote_address,
+            std::shared_ptr<const ConnectionContext> context, Handler&& request_handler)
+        : SessionBase(std::move(socket), remote_address, std::move(context))
         , request_handler_(std::forward<Handler>(request_handler)) {
     }
 private:
-    void HandleRequest(HttpRequest&& request) override {
+    void HandleRequest(HttpRequest&& request, uint64_t sequence) override {
         // Захватываем умный указатель на текущий объект Session в лямбде,
         // чтобы продлить время жизни сессии до вызова лямбды.
         // Используется generic-лямбда функция, способная принять response произвольного типа
-        request_handler_(std::move(request), [self = this->shared_from_this()](auto&& response) {
-            self->Write(std::move(response));
+        request_handler_(std::move(request), GetRemoteAddress(), [self = this->shared_from_this(), sequence](auto&& response) {
+            self->Write(std::move(response), sequence);
         });
     }
 
@@ -147,15 +404,38 @@ private:
     RequestHandler request_handler_;
 };
 
+struct ListenerOptions {
+    // Несколько acceptor на одном порту (SO_REUSEPORT): ядро само распределяет между ними соединения
+    bool reuse_port = false;
+    // io_context обслуживается одним потоком, поэтому acceptor и сокетам не нужен strand
+    bool single_threaded = false;
+    // Соединения обслуживаются сопрограммами CoroSession вместо цепочек обработчиков Session
+    bool coroutine_sessions = false;
+    ConnectionLimits limits;
+    // Счётчик соединений, общий для acceptor всех reactor. Если не задан, у acceptor будет свой
+    std::shared_ptr<ConnectionCounter> counter;
+    // Получатель соединений, запросивших переход на WebSocket. Если не задан, Upgrade обрабатывается как обычный запрос
+    UpgradeHandler upgrade;
+};
+
 template <typename RequestHandler>
 class Listener : public std::enable_shared_from_this<Listener<RequestHandler>> {
 public:
     template <typename Handler>
-    Listener(net::io_context& ioc, const tcp::endpoint& endpoint, Handler&& request_handler)
+    Listener(net::io_context& ioc, const tcp::endpoint& endpoint, Handler&& request_handler, ListenerOptions options)
         : ioc_(ioc)
+        , options_(options)
         // Обработчики асинхронных операций acceptor_ будут вызываться в своём strand
-        , acceptor_(net::make_strand(ioc))
+        , acceptor_(MakeExecutor())
         , request_handler_(std::forward<Handler>(request_handler)) {
+        auto context = std::make_shared<ConnectionContext>();
+        context->limits = options_.limits;
+        context->counter = options_.counter ? options_.counter : std::make_shared<ConnectionCounter>(options_.limits);
+        context->reaper = std::make_shared<IdleReaper>(acceptor_.get_executor(), options_.limits.idle_timeout);
+        context->reaper->Start();
+        context->upgrade = options_.upgrade;
+        context_ = std::move(context);
+
         // Открываем acceptor, используя протокол (IPv4 или IPv6), указанный в endpoint
         acceptor_.open(endpoint.protocol());
 
@@ -164,6 +444,12 @@ public:
         // Однако это может помешать повторно открыть сокет в полузакрытом состоянии.
         // Флаг reuse_address разрешает открыть сокет, когда он "наполовину закрыт"
         acceptor_.set_option(net::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (options_.reuse_port) {
+            using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+            acceptor_.set_option(reuse_port(true));
+        }
+#endif
         // Привязываем acceptor к адресу и порту endpoint
         acceptor_.bind(endpoint);
         // Переводим acceptor в состояние, в котором он способен принимать новые соединения
@@ -176,11 +462,18 @@ public:
     }
 
 private:
+    net::any_io_executor MakeExecutor() {
+        if (options_.single_threaded) {
+            return ioc_.get_executor();
+        }
+        return net::make_strand(ioc_);
+    }
+
     void DoAccept() {
         acceptor_.async_accept(
             // Передаём последовательный исполнитель, в котором будут вызываться обработчики
-            // асинхронных операций сокета
-            net::make_strand(ioc_),
+            // асинхронных операций сокета. Соединение остаётся в io_context этого acceptor
+            MakeExecutor(),
             // С помощью bind_front_handler создаём обработчик, привязанный к методу OnAccept
             // текущего объекта.
             // Так как Listener — шаблонный класс, нужно подсказать компилятору, что
@@ -200,29 +493,65 @@ private:
             return ReportError(ec, "accept"sv);
         }
 
-        // Асинхронно обрабатываем сессию
-        AsyncRunSession(std::move(socket));
+        // Асинхронно обрабатываем сессию, если соединение укладывается в лимиты
+        if (auto remote_address = Admit(socket)) {
+            AsyncRunSession(std::move(socket), *remote_address);
+        }
 
         // Принимаем новое соединение
         DoAccept();
     }
 
-    void AsyncRunSession(tcp::socket&& socket) {
-        std::make_shared<Session<RequestHandler>>(std::move(socket), request_handler_)->Run();
+    /*
+        Занимает место соединения в лимитах и возвращает адрес клиента.
+        Если сервер заполнен, место освобождается закрытием самого давнего простаивающего соединения.
+        Соединение сверх лимита адреса или без простаивающих соединений сразу закрывается
+    */
+    std::optional<net::ip::address> Admit(tcp::socket& socket) {
+        using Admission = ConnectionCounter::Admission;
+        beast::error_code ec;
+        net::ip::address remote_address = socket.remote_endpoint(ec).address();
+
+        switch (context_->counter->TryAcquire(remote_address)) {
+            case Admission::ACCEPTED:
+                return remote_address;
+            case Admission::SERVER_FULL:
+                if (context_->reaper->EvictOldest()) {
+                    context_->counter->AcquireEvicted(remote_address);
+                    return remote_address;
+                }
+                break;
+            case Admission::IP_FULL:
+                break;
+        }
+        socket.close(ec);
+        return std::nullopt;
+    }
+
+    void AsyncRunSession(tcp::socket&& socket, const net::ip::address& remote_address) {
+        if (options_.coroutine_sessions) {
+            return std::make_shared<CoroSession<RequestHandler>>(std::move(socket), remote_address, context_,
+                                                                 request_handler_)->Run();
+        }
+        std::make_shared<Session<RequestHandler>>(std::move(socket), remote_address, context_,
+                                                  request_handler_)->Run();
     }
 
     net::io_context& ioc_;
+    ListenerOptions options_;
+    std::shared_ptr<const ConnectionContext> context_;
     tcp::acceptor acceptor_;
     RequestHandler request_handler_;
 };
 
 template <typename RequestHandler>
-void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler) {
+void ServeHttp(net::io_context& ioc, const tcp::endpoint& endpoint, RequestHandler&& handler,
+               ListenerOptions options = {}) {
     // При помощи decay_t исключим ссылки из типа RequestHandler,
     // чтобы Listener хранил RequestHandler по значению
     using MyListener = Listener<std::decay_t<RequestHandler>>;
 
-    std::make_shared<MyListener>(ioc, endpoint, std::forward<RequestHandler>(handler))->Run();
+    std::make_shared<MyListener>(ioc, endpoint, std::forward<RequestHandler>(handler), options)->Run();
 }
 
 }  // namespace http_server
@@ -19,4 +19,27 @@ unsigned LootGenerator::Generate(TimeInterval time_delta, unsigned loot_count,
     return generated_loot;
 }
 
+std::optional<LootGenerator::TimeInterval> LootGenerator::TimeToNextLoot(TimeInterval time_delta, 
+                                                                        unsigned loot_count,
+                                                                        unsigned looter_count) const {
+    const unsigned loot_shortage = loot_count > looter_count ? 0u : looter_count - loot_count;
+    if (loot_shortage == 0 || probability_ <= 0.0) {
+        return std::nullopt;
+    }
+
+    // Generate вернёт ненулевое значение, как только loot_shortage * probability >= 0.5,
+    // то есть когда 1 - (1 - probability_)^ratio >= 0.5 / loot_shortage
+    double required_ratio = 0.0;
+    if (probability_ < 1.0) {
+        required_ratio = std::log(1.0 - 0.5 / loot_shortage) / std::log(1.0 - probability_);
+    }
+
+    // При нулевом отрезке времени вероятность появления трофея нулевая
+    const auto required_time = std::max(TimeInterval{1}, std::chrono::ceil<TimeInterval>(
+        std::chrono::duration<double, TimeInterval::period>{required_ratio * base_interval_.count()}));
+    const TimeInterval elapsed = time_without_loot_ + time_delta;
+
+    return elapsed >= required_time ? TimeInterval{0} : required_time - elapsed;
+}
+
 } // namespace loot_gen
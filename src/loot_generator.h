@@ -1,6 +1,7 @@
 #pragma once
 #include <chrono>
 #include <functional>
+#include <optional>
 
 namespace loot_gen {
 
@@ -35,6 +36,20 @@ public:
      */
     unsigned Generate(TimeInterval time_delta, unsigned loot_count, unsigned looter_count);
 
+    /*
+     * Возвращает промежуток времени, отсчитываемый от момента time_delta, 
+     * по прошествии которого Generate вернёт ненулевое количество трофеев 
+     * при неизменных loot_count и looter_count.
+     * Время оценивается снизу: считается, что генератор случайных чисел выдал 1.
+     * Если трофеи появиться не могут, возвращает nullopt.
+     *
+     * time_delta - отрезок времени, прошедший с момента предыдущего вызова Generate
+     * loot_count - количество трофеев на карте
+     * looter_count - количество мародёров на карте
+     */
+    std::optional<TimeInterval> TimeToNextLoot(TimeInterval time_delta, unsigned loot_count, 
+                                                unsigned looter_count) const;
+
     TimeInterval GetPeriod() const{
         return base_interval_;
     }
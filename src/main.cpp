@@ -4,6 +4,11 @@
 #include <boost/asio/signal_set.hpp>
 #include <thread>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "json_loader.h"
 #include "request_handler.h"
 #include "http_server.h"
@@ -28,6 +33,30 @@ void RunWorkers(unsigned n, const Fn& fn) {
     fn();
 }
 
+// Закрепляет текущий поток за ядром core
+void PinThreadToCore(unsigned core) {
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(core % CPU_SETSIZE, &cpu_set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#endif
+}
+
+// Запускает каждый io_context в своём потоке, закреплённом за отдельным ядром, включая текущий
+void RunReactors(const std::vector<std::unique_ptr<net::io_context>>& reactors) {
+    std::vector<std::jthread> workers;
+    workers.reserve(reactors.size() - 1);
+    for (unsigned i = 1; i < reactors.size(); ++i) {
+        workers.emplace_back([&reactors, i] {
+            PinThreadToCore(i);
+            reactors[i]->run();
+        });
+    }
+    PinThreadToCore(0);
+    reactors.front()->run();
+}
+
 }  // namespace
 
 int main(int argc, const char* argv[]) {
@@ -59,15 +88,34 @@ int main(int argc, const char* argv[]) {
         const cmd_parser::Args& received_args = args.value();
         // 1. Загружаем карту из файла и построить модель игры
         model::Game game = json_loader::LoadGame(received_args.config_file);
+        if(received_args.random_seed.has_value()){
+            game.SetRandomSeed(*received_args.random_seed);
+        }
+        game.SetHugePagesEnabled(received_args.huge_pages);
+        if(received_args.region_workers > 0){
+            /* Полос больше, чем потоков, чтобы выровнять нагрузку при неравномерной плотности собак */
+            game.SetRegionDecomposition(received_args.region_workers, received_args.region_workers * 4);
+        }
 
-        // 2. Инициализируем io_context
-        net::io_context ioc(NUM_THREADS);
+        // 2. Инициализируем io_context. В режиме reactor-per-core у каждого ядра свой io_context,
+        //    обслуживаемый одним потоком, а игровая логика выполняется в strand реактора 0:
+        //    остальные реакторы передают ему запросы через post и получают ответы тем же способом
+        const bool reactor_per_core = received_args.reactor_per_core;
+        const unsigned reactors_count = reactor_per_core ? std::max(1u, NUM_THREADS) : 1;
+        std::vector<std::unique_ptr<net::io_context>> reactors;
+        reactors.reserve(reactors_count);
+        for (unsigned i = 0; i < reactors_count; ++i) {
+            reactors.push_back(std::make_unique<net::io_context>(reactor_per_core ? 1 : NUM_THREADS));
+        }
+        net::io_context& ioc = *reactors.front();
 
         // 3. Добавляем асинхронный обработчик сигналов SIGINT и SIGTERM
         net::signal_set signals(ioc, SIGINT, SIGTERM);
-        signals.async_wait([&ioc](const sys::error_code& ec, [[maybe_unused]] int signal_number) {
+        signals.async_wait([&reactors](const sys::error_code& ec, [[maybe_unused]] int signal_number) {
             if (!ec) {
-                ioc.stop();
+                for (auto& reactor : reactors) {
+                    reactor->stop();
+                }
                 std::cout << std::endl;
             }
         });   
@@ -81,22 +129,48 @@ int main(int argc, const char* argv[]) {
         //    то нужно попытаться восстанавливать его.
         //    Если он некорректен, то приложение завершится с ошибкой
         handler->LoadState();
+        if(received_args.max_players.has_value()){
+            handler->ReservePlayers(*received_args.max_players);
+        }
 
-        // 6. Запустить обработчик HTTP-запросов, делегируя их обработчику запросов
+        // 6. Запустить обработчик HTTP-запросов, делегируя их обработчику запросов.
+        //    Лимит соединений общий для всех реакторов
         const auto address = net::ip::make_address("0.0.0.0");
         constexpr net::ip::port_type port = 8080;
-        http_server::ServeHttp(ioc, {address, port}, [&handler](auto&& req, auto&& send) {
-            (*handler)(std::forward<decltype(req)>(req), std::forward<decltype(send)>(send));
-        });
+        http_server::ConnectionLimits limits{
+            .max_connections = received_args.max_connections,
+            .max_connections_per_ip = received_args.max_connections_per_ip,
+            .max_header_size = received_args.max_header_size,
+            .max_body_size = received_args.max_body_size,
+            .idle_timeout = std::chrono::seconds(received_args.idle_timeout),
+            .header_timeout = std::chrono::seconds(received_args.header_timeout),
+            .write_timeout = std::chrono::seconds(received_args.write_timeout)};
+        auto connections_counter = std::make_shared<http_server::ConnectionCounter>(limits);
+        for (auto& reactor : reactors) {
+            http_server::ServeHttp(*reactor, {address, port}, [&handler](auto&& req, const auto& remote_address, auto&& send) {
+                (*handler)(std::forward<decltype(req)>(req), remote_address, std::forward<decltype(send)>(send));
+            }, {.reuse_port = reactor_per_core,
+                .single_threaded = reactor_per_core,
+                .coroutine_sessions = received_args.coroutine_sessions,
+                .limits = limits,
+                .counter = connections_counter,
+                .upgrade = [&handler](auto&& stream, auto&& req, auto&& slot) {
+                    handler->Upgrade(std::move(stream), std::move(req), std::move(slot));
+                }});
+        }
         
 
         // Эта надпись сообщает тестам о том, что сервер запущен и готов обрабатывать запросы
         LOG_SERVER_START(port, address.to_string());
 
         // 7. Запускаем обработку асинхронных операций
-        RunWorkers(std::max(1u, NUM_THREADS), [&ioc] {
-            ioc.run();
-        });
+        if (reactor_per_core) {
+            RunReactors(reactors);
+        } else {
+            RunWorkers(std::max(1u, NUM_THREADS), [&ioc] {
+                ioc.run();
+            });
+        }
 
         // 8. Сохраняем игровое состояние при выходе
         handler->SaveState();
@@ -0,0 +1,133 @@
+#pragma once
+#include <memory_resource>
+#include <memory>
+#include <optional>
+#include <cstddef>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace util {
+
+/*
+    Источник памяти, выделяющий крупные блоки в страницах mmap
+    с подсказкой ядру использовать большие (huge) страницы.
+    Мелкие блоки передаются вышестоящему источнику.
+    Используется как upstream для пула сущностей больших сессий
+*/
+class HugePageResource : public std::pmr::memory_resource {
+public:
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    explicit HugePageResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept
+        : upstream_(upstream) {
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+#ifdef __linux__
+        if (bytes >= HUGE_PAGE_SIZE) {
+            void* ptr = mmap(nullptr, RoundUp(bytes), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            madvise(ptr, RoundUp(bytes), MADV_HUGEPAGE);
+            return ptr;
+        }
+#endif
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+#ifdef __linux__
+        if (bytes >= HUGE_PAGE_SIZE) {
+            munmap(ptr, RoundUp(bytes));
+            return;
+        }
+#endif
+        upstream_->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    static size_t RoundUp(size_t bytes) noexcept {
+        return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    std::pmr::memory_resource* upstream_;
+};
+
+/*
+    Арена для временных данных одного тика.
+    Память выделяется монотонно из собственного буфера и
+    освобождается целиком вызовом Reset в начале следующего тика.
+    Если за тик буфера не хватило, при сбросе он увеличивается,
+    так что в установившемся режиме тик не обращается к куче
+*/
+class ScratchArena {
+public:
+    explicit ScratchArena(size_t initial_capacity = 16 * 1024) {
+        Allocate(initial_capacity);
+    }
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    /* Освобождает всю выделенную за тик память и возвращает источник для нового тика */
+    std::pmr::memory_resource* Reset() {
+        if (overflow_.GetAllocated() > 0) {
+            Allocate(capacity_ + overflow_.GetAllocated());
+        } else {
+            resource_.emplace(buffer_.get(), capacity_, &overflow_);
+        }
+        return &*resource_;
+    }
+
+private:
+    /* Учитывает память, запрошенную сверх буфера арены */
+    class OverflowCounter : public std::pmr::memory_resource {
+    public:
+        size_t GetAllocated() const noexcept {
+            return allocated_;
+        }
+
+        void ResetCounter() noexcept {
+            allocated_ = 0;
+        }
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            allocated_ += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+            std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+        size_t allocated_ = 0;
+    };
+
+    void Allocate(size_t capacity) {
+        resource_.reset();
+        overflow_.ResetCounter();
+        capacity_ = capacity;
+        buffer_ = std::make_unique<std::byte[]>(capacity_);
+        resource_.emplace(buffer_.get(), capacity_, &overflow_);
+    }
+
+    size_t capacity_ = 0;
+    std::unique_ptr<std::byte[]> buffer_;
+    OverflowCounter overflow_;
+    std::optional<std::pmr::monotonic_buffer_resource> resource_;
+};
+
+}  // namespace util
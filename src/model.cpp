@@ -2,6 +2,10 @@
 
 #include <stdexcept>
 #include <set>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <tuple>
 
 namespace model {
 using namespace std::literals;
@@ -24,8 +28,8 @@ static const double OFFICE_WIDTH = 0.5;
 
 class ObjectsAndDogsProvider : public ItemGathererProvider{
 public:
-    using Objects = std::vector<Item>;
-    using Dogs = std::vector<Gatherer>;
+    using Objects = std::pmr::vector<Item>;
+    using Dogs = std::pmr::vector<Gatherer>;
 
     ObjectsAndDogsProvider(Objects objects, Dogs dogs)
     : objects_(std::move(objects)), dogs_(std::move(dogs)){}
@@ -50,8 +54,9 @@ private:
     Dogs dogs_;
 };
 
-ObjectsAndDogsProvider::Objects MakeLoot(const std::list<Loot>& loots){
-    ObjectsAndDogsProvider::Objects result;
+ObjectsAndDogsProvider::Objects MakeLoot(const GameSession::LootObjects& loots, std::pmr::memory_resource* scratch){
+    ObjectsAndDogsProvider::Objects result(scratch);
+    result.reserve(loots.size());
 
     for(const Loot& loot : loots){
         result.emplace_back(loot.pos, LOOT_WIDTH);
@@ -60,8 +65,9 @@ ObjectsAndDogsProvider::Objects MakeLoot(const std::list<Loot>& loots){
     return result;
 }
 
-ObjectsAndDogsProvider::Objects MakeOffices(const std::deque<Office>& offices){
-    ObjectsAndDogsProvider::Objects result;
+ObjectsAndDogsProvider::Objects MakeOffices(const std::deque<Office>& offices, std::pmr::memory_resource* scratch){
+    ObjectsAndDogsProvider::Objects result(scratch);
+    result.reserve(offices.size());
 
     for(const Office& office : offices){
         Point2D pos = {
@@ -74,8 +80,9 @@ ObjectsAndDogsProvider::Objects MakeOffices(const std::deque<Office>& offices){
     return result;
 }
 
-ObjectsAndDogsProvider::Dogs MakeDogs(const std::list<Dog>& dogs, double delta){
-    ObjectsAndDogsProvider::Dogs result;
+ObjectsAndDogsProvider::Dogs MakeDogs(const GameSession::Dogs& dogs, double delta, std::pmr::memory_resource* scratch){
+    ObjectsAndDogsProvider::Dogs result(scratch);
+    result.reserve(dogs.size());
 
     for(const Dog& dog : dogs){
         PairDouble speed = *(dog.GetSpeed());
@@ -94,12 +101,25 @@ enum class GatheringEventType{
     DOG_DELIVER_ALL_ITEMS
 };
 
+using Event = std::pair<GatheringEvent, GatheringEventType>;
+
+/*
+    Единый порядок событий для обычного и полосного обновления.
+    Одновременные события упорядочиваются по собаке, типу и предмету,
+    иначе итог зависел бы от порядка сортировки и разбиения на полосы
+*/
+bool EventBefore(const Event& lhs, const Event& rhs){
+    return std::tie(lhs.first.time, lhs.first.gatherer_id, lhs.second, lhs.first.item_id) 
+            < std::tie(rhs.first.time, rhs.first.gatherer_id, rhs.second, rhs.first.item_id);
+}
+
 /*
     Смешивает события столкновений в хронологическом порядке
 */
-using Event = std::pair<GatheringEvent, GatheringEventType>;
-std::vector<Event> MixEvents(std::vector<GatheringEvent> collectings, std::vector<GatheringEvent> deliverings){
-    std::vector<Event> result;
+std::pmr::vector<Event> MixEvents(const std::vector<GatheringEvent>& collectings, 
+                                    const std::vector<GatheringEvent>& deliverings,
+                                    std::pmr::memory_resource* scratch){
+    std::pmr::vector<Event> result(scratch);
     size_t collectings_count = collectings.size();
     size_t deliverings_count = deliverings.size();
     
@@ -116,13 +136,134 @@ std::vector<Event> MixEvents(std::vector<GatheringEvent> collectings, std::vecto
     });
 
     /* Сортируем в хронологическом порядке */
-    std::sort(result.begin(), result.end(),[](const Event& lhs, const Event& rhs){
-        return lhs.first.time < rhs.first.time;
-    });
+    std::sort(result.begin(), result.end(), EventBefore);
 
     return result;
 }
 
+/*
+    Применяет события столкновений к собакам и трофеям сессии.
+    События должны быть упорядочены по времени:
+    предмет достаётся собаке, которая первой до него дошла
+*/
+void ApplyGatherEvents(GameSession& session, const std::pmr::vector<Event>& events, 
+                        std::pmr::memory_resource* scratch){
+    std::pmr::vector<Dog*> dogs(scratch);
+    dogs.reserve(session.GetDogs().size());
+    for(Dog& dog : session.GetDogs()){
+        dogs.push_back(&dog);
+    }
+
+    std::pmr::vector<const Loot*> all_loots(scratch);
+    all_loots.reserve(session.GetLootObjects().size());
+    for(const Loot& loot : session.GetLootObjects()){
+        all_loots.push_back(&loot);
+    }
+
+    unsigned max_bag_capacity = session.GetMap()->GetBagCapacity();
+    std::pmr::set<size_t> collected_loot(scratch);
+    for(const auto& [event, event_type] : events){
+        Dog& dog = *dogs[event.gatherer_id];
+        switch (event_type){
+            case GatheringEventType::DOG_COLLECT_ITEM:
+                // Собака подбирает предмет
+                // если её рюкзак не полон
+                if((*dog.GetBag()).size() < max_bag_capacity){
+                    // если до этого этот предмет не подбирали
+                    if(!collected_loot.count(event.item_id)){
+                        dog.CollectItem(*all_loots[event.item_id]);
+                        collected_loot.insert(event.item_id);
+                    }
+                }
+                break;
+            case GatheringEventType::DOG_DELIVER_ALL_ITEMS:
+                dog.ClearBag();
+                break;
+        
+            default:
+                break;
+        }
+    }
+
+    /* Подобранные предметы должны пропасть с карты*/
+    session.DeleteCollectedLoot(collected_loot);
+}
+
+/*
+    Ищет события столкновений для собак одной полосы карты.
+    В полосу попадают все трофеи и офисы, до которых могут дотянуться её собаки,
+    поэтому трофеи у границы рассматриваются сразу несколькими полосами.
+    Номера собак и трофеев в событиях - сквозные по всей сессии
+*/
+std::pmr::vector<Event> FindRegionEvents(const std::pmr::vector<size_t>& region_dogs, 
+                                        const std::pmr::vector<Dog*>& dogs,
+                                        const std::pmr::vector<const Loot*>& loots,
+                                        const std::pmr::vector<size_t>& loot_by_x,
+                                        const std::deque<Office>& offices,
+                                        double delta, std::pmr::memory_resource* scratch){
+    ObjectsAndDogsProvider::Dogs gatherers(scratch);
+    gatherers.reserve(region_dogs.size());
+
+    double min_x = std::numeric_limits<double>::max();
+    double max_x = std::numeric_limits<double>::lowest();
+    for(size_t dog_id : region_dogs){
+        PairDouble speed = *(dogs[dog_id]->GetSpeed());
+        Point2D start_pos = *(dogs[dog_id]->GetPosition());
+        Point2D end_pos = {start_pos.x + speed.x * delta, start_pos.y + speed.y * delta};
+        gatherers.emplace_back(start_pos, end_pos, DOG_WIDTH);
+
+        min_x = std::min({min_x, start_pos.x, end_pos.x});
+        max_x = std::max({max_x, start_pos.x, end_pos.x});
+    }
+
+    /* Дальше этого расстояния по x от пути собаки ничего подобрать нельзя */
+    const double reach = DOG_WIDTH + std::max(LOOT_WIDTH, OFFICE_WIDTH);
+    auto loot_begin = std::lower_bound(loot_by_x.begin(), loot_by_x.end(), min_x - reach, 
+                                        [&loots](size_t loot_id, double x){
+        return loots[loot_id]->pos.x < x;
+    });
+    auto loot_end = std::upper_bound(loot_begin, loot_by_x.end(), max_x + reach, 
+                                        [&loots](double x, size_t loot_id){
+        return x < loots[loot_id]->pos.x;
+    });
+
+    ObjectsAndDogsProvider::Objects items(scratch);
+    items.reserve(std::distance(loot_begin, loot_end));
+    for(auto it = loot_begin; it != loot_end; ++it){
+        items.emplace_back(loots[*it]->pos, LOOT_WIDTH);
+    }
+
+    ObjectsAndDogsProvider::Objects region_offices(scratch);
+    std::pmr::vector<size_t> office_ids(scratch);
+    for(size_t office_id = 0; office_id < offices.size(); ++office_id){
+        Point2D pos = {
+            static_cast<double>(offices[office_id].GetPosition().x), 
+            static_cast<double>(offices[office_id].GetPosition().y)
+        };
+        if(min_x - reach <= pos.x && pos.x <= max_x + reach){
+            region_offices.emplace_back(pos, OFFICE_WIDTH);
+            office_ids.push_back(office_id);
+        }
+    }
+
+    ObjectsAndDogsProvider loots_provider(std::move(items), ObjectsAndDogsProvider::Dogs(gatherers, scratch));
+    ObjectsAndDogsProvider offices_provider(std::move(region_offices), std::move(gatherers));
+    auto events = MixEvents(FindGatherEvents(loots_provider), FindGatherEvents(offices_provider), scratch);
+
+    /* Переводим номера внутри полосы в номера сессии */
+    size_t first_loot = loot_begin - loot_by_x.begin();
+    for(auto& [event, event_type] : events){
+        event.gatherer_id = region_dogs[event.gatherer_id];
+        if(event_type == GatheringEventType::DOG_COLLECT_ITEM){
+            event.item_id = loot_by_x[first_loot + event.item_id];
+        } else {
+            event.item_id = office_ids[event.item_id];
+        }
+    }
+
+    return events;
+}
+
 } // namespace detail
 
 /* ------------------------ Map ----------------------------------- */
@@ -151,8 +292,11 @@ const Map::LootTypes& Map::GetLootTypes() const noexcept{
     return loot_types_;
 }
 
-unsigned Map::GetRandomLootType() const{
-    return GetRandomNumber(0, loot_types_.size());
+unsigned Map::GetRandomLootType(util::Random& random) const{
+    if(loot_types_.empty()){
+        return 0;
+    }
+    return random.NextBelow(loot_types_.size());
 }
 
 void Map::AddRoad(const Road& road) {
@@ -218,20 +362,86 @@ PairDouble Map::GetFirstPos(const model::Map::Roads& roads){
     return {static_cast<double>(pos.x), static_cast<double>(pos.y)};
 }
 
-PairDouble Map::GetRandomPos(const model::Map::Roads& roads){
-    model::Map::RoadTag tag = model::Map::RoadTag(GetRandomNumber(0, 2));
-    size_t road_index = GetRandomNumber(0, roads.size());
-    const model::Road& road = *(roads.begin());
-    double x = 0;
-    double y = 0;
-    if(road.IsHorizontal()){
-        x = GetRandomNumber(road.GetStart().x, road.GetEnd().x);
-        y = road.GetStart().y;
-    } else if(road.IsVertical()){
-        x = road.GetStart().x;
-        y = GetRandomNumber(road.GetStart().y, road.GetEnd().y);
+void Map::BuildSpawnTable(){
+    std::vector<double> lengths;
+    lengths.reserve(roads_.size());
+    for(const Road& road : roads_){
+        Point start = road.GetStart();
+        Point end = road.GetEnd();
+        lengths.push_back(std::abs(end.x - start.x) + std::abs(end.y - start.y));
     }
-    return {x,y};
+
+    road_spawn_table_ = util::AliasTable(lengths);
+}
+
+PairDouble Map::GetRandomPos(util::Random& random) const{
+    if(roads_.empty()){
+        return {};
+    }
+
+    /* Дорога выбирается с вероятностью, пропорциональной её длине */
+    const Road& road = road_spawn_table_.IsEmpty() 
+        ? roads_[random.NextBelow(roads_.size())] 
+        : roads_[road_spawn_table_.Sample(random)];
+
+    Point start = road.GetStart();
+    Point end = road.GetEnd();
+    double ratio = random.NextDouble();
+
+    return {start.x + (end.x - start.x) * ratio, start.y + (end.y - start.y) * ratio};
+}
+
+void Map::BuildRegions(size_t count){
+    region_bounds_.clear();
+    if(count < 2 || roads_.empty()){
+        return;
+    }
+
+    /* Длина каждой дороги относится к середине её проекции на ось x */
+    std::vector<std::pair<double, double>> lengths_by_x;
+    lengths_by_x.reserve(roads_.size());
+    double total_length = 0;
+    for(const Road& road : roads_){
+        Point start = road.GetStart();
+        Point end = road.GetEnd();
+        double length = std::abs(end.x - start.x) + std::abs(end.y - start.y);
+        lengths_by_x.emplace_back((start.x + end.x) / 2.0, length);
+        total_length += length;
+    }
+    std::sort(lengths_by_x.begin(), lengths_by_x.end());
+
+    const auto verticals = road_map_.find(Map::RoadTag::VERTICAL);
+    double accumulated = 0;
+    for(const auto& [x, length] : lengths_by_x){
+        accumulated += length;
+        while(region_bounds_.size() + 1 < count 
+                && accumulated >= total_length * (region_bounds_.size() + 1) / count){
+            double bound = x;
+            /* Сдвигаем границу на ближайшую вертикальную дорогу справа */
+            if(verticals != road_map_.end()){
+                if(auto it = verticals->second.lower_bound(x); it != verticals->second.end()){
+                    bound = it->first;
+                }
+            }
+            if(!region_bounds_.empty()){
+                bound = std::max(bound, region_bounds_.back());
+            }
+            region_bounds_.push_back(bound);
+        }
+    }
+
+    /* Полос всегда ровно count, часть из них может оказаться пустой */
+    while(region_bounds_.size() + 1 < count){
+        region_bounds_.push_back(region_bounds_.empty() ? lengths_by_x.back().first : region_bounds_.back());
+    }
+}
+
+size_t Map::GetRegionsCount() const{
+    return region_bounds_.size() + 1;
+}
+
+size_t Map::FindRegion(double x) const{
+    return std::upper_bound(region_bounds_.begin(), region_bounds_.end(), x) - region_bounds_.begin();
 }
 
 void Map::FindInVerticals(const Dog::Position& pos, std::vector<const Road*>& roads) const{
@@ -307,18 +517,22 @@ const Map* GameSession::GetMap() const {
     return map_;
 }
 
-std::list<Dog>& GameSession::GetDogs(){
+PairDouble GameSession::GetRandomPos(){
+    return map_->GetRandomPos(random_);
+}
+
+GameSession::Dogs& GameSession::GetDogs(){
     return dogs_;
 }
 
-const std::list<Dog>& GameSession::GetDogs() const{
-    return static_cast<const std::list<Dog>&>(dogs_);
+const GameSession::Dogs& GameSession::GetDogs() const{
+    return static_cast<const Dogs&>(dogs_);
 }
 
 void GameSession::UpdateLoot(unsigned loot_count){
     for(unsigned i = 0; i < loot_count; ++i){
-        unsigned type = map_->GetRandomLootType();
-        PairDouble pos = Map::GetRandomPos(map_->GetRoads());
+        unsigned type = map_->GetRandomLootType(random_);
+        PairDouble pos = map_->GetRandomPos(random_);
         unsigned value = 1;
 
         const LootType& loot_type = map_->GetLootTypes().at(type);
@@ -329,18 +543,26 @@ void GameSession::UpdateLoot(unsigned loot_count){
     }
 }
 
-void GameSession::SetLootObjects(std::list<Loot> new_loot){
-    loot_ = std::move(new_loot);
+unsigned GameSession::GetLootShortage() const{
+    return loot_.size() < dogs_.size() ? dogs_.size() - loot_.size() : 0u;
 }
 
-const std::list<Loot>& GameSession::GetLootObjects() const{
+void GameSession::SetLootObjects(const std::list<Loot>& new_loot){
+    loot_.assign(new_loot.begin(), new_loot.end());
+}
+
+const GameSession::LootObjects& GameSession::GetLootObjects() const{
     return loot_;
 }
 
-void GameSession::DeleteCollectedLoot(const std::set<size_t>& collected_items){
-    for(auto collect_id = collected_items.rbegin(); collect_id != collected_items.rend(); std::advance(collect_id, 1)){
-        auto it = std::next(loot_.begin(), *collect_id);
-        loot_.erase(it);
+void GameSession::DeleteCollectedLoot(const std::pmr::set<size_t>& collected_items){
+    /* Один проход по списку: номера в наборе упорядочены по возрастанию */
+    auto loot_it = loot_.begin();
+    size_t loot_id = 0;
+    for(size_t collect_id : collected_items){
+        std::advance(loot_it, collect_id - loot_id);
+        loot_it = loot_.erase(loot_it);
+        loot_id = collect_id + 1;
     }
 }
 
@@ -352,6 +574,43 @@ void GameSession::DeleteDog(const Dog* erasing_dog){
     dogs_.erase(it);
 }
 
+std::pmr::memory_resource* GameSession::ResetTickScratch(){
+    return tick_scratch_.Reset();
+}
+
+void GameSession::SetLootGenerator(loot_gen::LootGenerator loot_generator, detail::Milliseconds now){
+    loot_generator_.emplace(std::move(loot_generator));
+    last_loot_generation_ = now;
+}
+
+std::optional<detail::Milliseconds> GameSession::ScheduleLoot(detail::Milliseconds now, detail::Milliseconds min_delay){
+    ++loot_schedule_id_;
+    if(!loot_generator_.has_value()){
+        return std::nullopt;
+    }
+
+    auto delay = loot_generator_->TimeToNextLoot(now - last_loot_generation_, loot_.size(), dogs_.size());
+    if(!delay.has_value()){
+        return std::nullopt;
+    }
+    return now + std::max(*delay, min_delay);
+}
+
+unsigned GameSession::GetLootScheduleId() const{
+    return loot_schedule_id_;
+}
+
+unsigned GameSession::GenerateLoot(detail::Milliseconds now){
+    if(!loot_generator_.has_value()){
+        return 0;
+    }
+
+    unsigned loot_count = loot_generator_->Generate(now - last_loot_generation_, loot_.size(), dogs_.size());
+    last_loot_generation_ = now;
+    UpdateLoot(loot_count);
+    return loot_count;
+}
+
 /* ------------------------ Game ----------------------------------- */
 
 void Game::AddMap(Map&& map) {
@@ -360,7 +619,9 @@ void Game::AddMap(Map&& map) {
         throw std::invalid_argument("Map with id "s + *map.GetId() + " already exists"s);
     } else {
         try {
-            maps_.emplace_back(std::move(map));
+            Map& added_map = maps_.emplace_back(std::move(map));
+            added_map.BuildSpawnTable();
+            added_map.BuildRegions(regions_count_);
         } catch (...) {
             map_id_to_index_.erase(it);
             throw;
@@ -370,7 +631,10 @@ void Game::AddMap(Map&& map) {
 
 GameSession* Game::AddSession(const Map::Id& map_id){
     if(const Map* map = FindMap(map_id); map != nullptr){
-        GameSession* session = &(map_id_to_sessions_[map_id].emplace_back(map));
+        GameSession* session = &(map_id_to_sessions_[map_id].emplace_back(map, session_seeds_(), huge_pages_enabled_));
+        if(loot_generator_.has_value()){
+            session->SetLootGenerator(*loot_generator_, game_time_);
+        }
         return session;
     }
     return nullptr;
@@ -418,6 +682,31 @@ unsigned Game::GetDogRetirementTime() const{
     return dog_retirement_time_;
 }
 
+void Game::SetRandomSeed(uint64_t seed){
+    session_seeds_ = util::SplitMix64(seed);
+}
+
+void Game::SetHugePagesEnabled(bool enabled){
+    huge_pages_enabled_ = enabled;
+}
+
+void Game::SetRegionDecomposition(unsigned workers, unsigned regions){
+    region_workers_.reset();
+    region_scratch_.clear();
+    regions_count_ = 0;
+    if(workers > 0){
+        region_workers_ = std::make_unique<util::WorkerPool>(workers);
+        regions_count_ = std::max(regions, 1u);
+        for(unsigned i = 0; i < regions_count_; ++i){
+            region_scratch_.emplace_back();
+        }
+    }
+
+    for(Map& map : maps_){
+        map.BuildRegions(regions_count_);
+    }
+}
+
 const Game::Maps& Game::GetMaps() const noexcept {
     return maps_;
 }
@@ -433,24 +722,60 @@ detail::Milliseconds Game::GetLootGeneratePeriod() const{
     return loot_generator_.value().GetPeriod();
 }
 
-void Game::GenerateLootInSessions(detail::Milliseconds delta){
-    for(auto& [map_id, sessions] : map_id_to_sessions_){
-        for(GameSession& session : sessions){
-            unsigned current_loot_count = session.GetLootObjects().size();
-            unsigned loot_count = (*loot_generator_).Generate(delta, current_loot_count, session.GetDogs().size());
-            session.UpdateLoot(loot_count);
+void Game::ScheduleLootSpawn(GameSession* session){
+    ScheduleLootSpawn(session, detail::Milliseconds{0});
+}
+
+void Game::ScheduleLootSpawn(GameSession* session, detail::Milliseconds min_delay){
+    if(auto time = session->ScheduleLoot(game_time_, min_delay); time.has_value()){
+        loot_spawns_.push({*time, session, session->GetLootScheduleId()});
+    }
+}
+
+void Game::SpawnScheduledLoot(){
+    while(!loot_spawns_.empty() && loot_spawns_.top().time <= game_time_){
+        LootSpawn spawn = loot_spawns_.top();
+        loot_spawns_.pop();
+
+        /* Запись устарела: сессию уже перепланировали */
+        if(spawn.schedule_id != spawn.session->GetLootScheduleId()){
+            continue;
+        }
+
+        /* 
+            Генератор может выдать меньше ожидаемого (случайный множитель < 1),
+            тогда повторная попытка будет не раньше, чем через базовый период 
+        */
+        if(spawn.session->GenerateLoot(game_time_) == 0){
+            ScheduleLootSpawn(spawn.session, GetLootGeneratePeriod());
+        } else {
+            ScheduleLootSpawn(spawn.session);
         }
     }
 }
 
 void Game::UpdateGameState(unsigned delta){
     double delta_in_seconds = static_cast<double>(delta) / 1000;
+    game_time_ += detail::Milliseconds(delta);
     for(auto& [map_id, sessions] : map_id_to_sessions_){
         for(GameSession& session : sessions){
-            UpdateDogsLoot(session, delta_in_seconds);
-            UpdateAllDogsPositions(session.GetDogs(), session.GetMap(), delta_in_seconds);
+            size_t loot_count = session.GetLootObjects().size();
+            std::pmr::memory_resource* scratch = session.ResetTickScratch();
+            if(region_workers_ && session.GetDogs().size() >= REGION_MIN_DOGS){
+                UpdateSessionByRegions(session, delta_in_seconds, scratch);
+            } else {
+                UpdateDogsLoot(session, delta_in_seconds, scratch);
+                UpdateAllDogsPositions(session.GetDogs(), session.GetMap(), delta_in_seconds, scratch);
+            }
+
+            /* Собаки подобрали трофеи - нехватка изменилась */
+            if(session.GetLootObjects().size() != loot_count){
+                ScheduleLootSpawn(&session);
+            }
         }
     }
+
+    SpawnScheduledLoot();
 }
 
 void Game::DisconnectDogFromSession(const GameSession* player_session, const Dog* erasing_dog){
@@ -463,16 +788,19 @@ void Game::DisconnectDogFromSession(const GameSession* player_session, const Dog
 
     GameSession& found_session = *it;
     found_session.DeleteDog(erasing_dog);
+    ScheduleLootSpawn(&found_session);
 }
 
-void Game::UpdateAllDogsPositions(std::list<Dog>& dogs, const Map* map, double delta){
+void Game::UpdateAllDogsPositions(GameSession::Dogs& dogs, const Map* map, double delta, 
+                                    std::pmr::memory_resource* scratch){
     for(Dog& dog : dogs){
         std::vector<const Road*> roads = map->FindRoadsByCoords(dog.GetPosition());
-        UpdateDogPos(dog, roads, delta);
+        UpdateDogPos(dog, roads, delta, scratch);
     }
 }
 
-void Game::UpdateDogPos(Dog& dog, const std::vector<const Road*>& roads, double delta){
+void Game::UpdateDogPos(Dog& dog, const std::vector<const Road*>& roads, double delta, 
+                        std::pmr::memory_resource* scratch){
     const auto [x, y] = *(dog.GetPosition());
     const auto [vx, vy] = *(dog.GetSpeed());
 
@@ -482,7 +810,7 @@ void Game::UpdateDogPos(Dog& dog, const std::vector<const Road*>& roads, double
     PairDouble result_pos(getting_pos);
     PairDouble result_speed(getting_speed);
 
-    std::set<PairDouble> collisions;
+    std::pmr::set<PairDouble> collisions(scratch);
 
     for(const Road* road : roads){
         Point start = road->GetStart();
@@ -522,48 +850,90 @@ void Game::UpdateDogPos(Dog& dog, const std::vector<const Road*>& roads, double
     dog.SetSpeed(Dog::Speed(result_speed));
 }   
 
-void Game::UpdateDogsLoot(GameSession& session, double delta) {
+void Game::UpdateDogsLoot(GameSession& session, double delta, std::pmr::memory_resource* scratch) {
     using namespace collision_detector;
-    std::list<Dog>& dogs = session.GetDogs();
-    const std::list<Loot>& all_loots = session.GetLootObjects();
-    unsigned max_bag_capacity = session.GetMap()->GetBagCapacity();
+    GameSession::Dogs& dogs = session.GetDogs();
+    const GameSession::LootObjects& all_loots = session.GetLootObjects();
     const std::deque<Office>& offices = session.GetMap()->GetOffices();
 
     /* Провайдер для предоставления событий при подборе предметов*/
-    detail::ObjectsAndDogsProvider loots_provider(detail::MakeLoot(all_loots), detail::MakeDogs(dogs, delta));
+    detail::ObjectsAndDogsProvider loots_provider(detail::MakeLoot(all_loots, scratch), 
+                                                    detail::MakeDogs(dogs, delta, scratch));
 
     /* Провайдер для предоставления событий при доставке в офис */
-    detail::ObjectsAndDogsProvider offices_provider(detail::MakeOffices(offices), detail::MakeDogs(dogs, delta));
-    auto events = detail::MixEvents(FindGatherEvents(loots_provider), FindGatherEvents(offices_provider));
-    std::set<size_t> collected_loot;
-    for(const auto& [event, event_type] : events){
-        auto dog_it = std::next(dogs.begin(), event.gatherer_id);
-        Dog& dog = *dog_it;
-        switch (event_type){
-            case detail::GatheringEventType::DOG_COLLECT_ITEM:
-                // Собака подбирает предмет
-                // если её рюкзак не полон
-                if((*dog.GetBag()).size() < max_bag_capacity){
-                    // если до этого этот предмет не подбирали
-                    if(!collected_loot.count(event.item_id)){
-                        auto loot_it = std::next(all_loots.begin(), event.item_id);
-                        const Loot& loot = *loot_it;
-                        dog.CollectItem(loot);
-                        collected_loot.insert(event.item_id);
-                    }
-                }
-                break;
-            case detail::GatheringEventType::DOG_DELIVER_ALL_ITEMS:
-                dog.ClearBag();
-                break;
-        
-            default:
-                break;
+    detail::ObjectsAndDogsProvider offices_provider(detail::MakeOffices(offices, scratch), 
+                                                    detail::MakeDogs(dogs, delta, scratch));
+    auto events = detail::MixEvents(FindGatherEvents(loots_provider), FindGatherEvents(offices_provider), scratch);
+    detail::ApplyGatherEvents(session, events, scratch);
+}
+
+void Game::UpdateSessionByRegions(GameSession& session, double delta, std::pmr::memory_resource* scratch){
+    const Map* map = session.GetMap();
+    const size_t regions_count = map->GetRegionsCount();
+
+    std::pmr::vector<Dog*> dogs(scratch);
+    dogs.reserve(session.GetDogs().size());
+    for(Dog& dog : session.GetDogs()){
+        dogs.push_back(&dog);
+    }
+
+    std::pmr::vector<const Loot*> loots(scratch);
+    loots.reserve(session.GetLootObjects().size());
+    for(const Loot& loot : session.GetLootObjects()){
+        loots.push_back(&loot);
+    }
+
+    /* Трофеи, упорядоченные по x: каждая полоса выбирает свои двоичным поиском */
+    std::pmr::vector<size_t> loot_by_x(loots.size(), scratch);
+    std::iota(loot_by_x.begin(), loot_by_x.end(), 0);
+    std::sort(loot_by_x.begin(), loot_by_x.end(), [&loots](size_t lhs, size_t rhs){
+        return loots[lhs]->pos.x < loots[rhs]->pos.x;
+    });
+
+    /* 
+        Собака принадлежит полосе, в которой находится в начале тика.
+        Перешедшая границу собака на следующем тике обрабатывается соседней полосой 
+    */
+    std::pmr::vector<std::pmr::vector<size_t>> region_dogs(regions_count, scratch);
+    for(size_t dog_id = 0; dog_id < dogs.size(); ++dog_id){
+        region_dogs[map->FindRegion((*dogs[dog_id]->GetPosition()).x)].push_back(dog_id);
+    }
+
+    /* Каждая полоса пользуется своей ареной, чтобы потоки не делили память */
+    std::pmr::vector<std::pmr::memory_resource*> region_resources(scratch);
+    std::vector<std::pmr::vector<detail::Event>> region_events;
+    region_events.reserve(regions_count);
+    for(size_t region = 0; region < regions_count; ++region){
+        region_resources.push_back(region_scratch_[region].Reset());
+        region_events.emplace_back(region_resources.back());
+    }
+
+    region_workers_->ParallelFor(regions_count, [&](size_t region){
+        if(!region_dogs[region].empty()){
+            region_events[region] = detail::FindRegionEvents(region_dogs[region], dogs, loots, loot_by_x, 
+                                                            map->GetOffices(), delta, region_resources[region]);
         }
+    });
+
+    /* Сводим события всех полос в единую хронологию */
+    size_t events_count = 0;
+    for(const auto& events : region_events){
+        events_count += events.size();
     }
+    std::pmr::vector<detail::Event> events(scratch);
+    events.reserve(events_count);
+    for(const auto& region : region_events){
+        events.insert(events.end(), region.begin(), region.end());
+    }
+    std::sort(events.begin(), events.end(), detail::EventBefore);
+    detail::ApplyGatherEvents(session, events, scratch);
 
-    /* Подобранные предметы должны пропасть с карты*/
-    session.DeleteCollectedLoot(collected_loot);
+    region_workers_->ParallelFor(regions_count, [&](size_t region){
+        for(size_t dog_id : region_dogs[region]){
+            Dog& dog = *dogs[dog_id];
+            UpdateDogPos(dog, map->FindRoadsByCoords(dog.GetPosition()), delta, region_resources[region]);
+        }
+    });
 }
 
 bool Game::IsInsideRoad(const PairDouble& getting_pos, const Point& start, const Point& end){
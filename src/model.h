@@ -9,17 +9,20 @@
 #include <list>
 #include <iostream>
 #include <optional>
-#include <boost/signals2.hpp>
+#include <queue>
+#include <random>
+#include <functional>
 
 #include "geom.h"
 #include "tagged.h"
+#include "random_generator.h"
+#include "memory_resource.h"
+#include "worker_pool.h"
 #include "loot_generator.h"
 #include "collision_detector.h"
 
 namespace model {
 
-namespace sig = boost::signals2;
-    
 namespace detail{
 
 using Milliseconds = std::chrono::milliseconds;
@@ -159,13 +162,30 @@ public:
     using Name = util::Tagged<std::string, Dog>;
     using Position = util::Tagged<PairDouble, Dog>;
     using Speed = util::Tagged<PairDouble, Dog>;
-    using SpeedSignal = sig::signal<void(Speed new_speed)>;
-    using Bag = util::Tagged<std::deque<Loot>, Dog>;
-
-    Dog(int id, Name name, Position pos, Speed speed, Direction dir) noexcept
+    /* 
+        Слушатель изменения скорости. У собаки он один - часы активности игрока,
+        поэтому хватает std::function без выделения памяти под соединение сигнала 
+    */
+    using SpeedListener = std::function<void(Speed new_speed)>;
+    using Bag = util::Tagged<std::pmr::deque<Loot>, Dog>;
+    /* Собака размещает рюкзак в памяти сессии, которой принадлежит */
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    Dog(int id, Name name, Position pos, Speed speed, Direction dir, 
+        const allocator_type& alloc = {})
         : id_(id), name_(name)
         , pos_(pos), speed_(speed), dir_(dir)
-        , bag_({}){
+        , bag_(std::pmr::deque<Loot>(alloc)){
+    }
+
+    Dog(Dog&& other) = default;
+
+    Dog(Dog&& other, const allocator_type& alloc)
+        : id_(other.id_), name_(std::move(other.name_))
+        , pos_(other.pos_), speed_(other.speed_)
+        , speed_listener_(std::move(other.speed_listener_)), dir_(other.dir_)
+        , bag_(std::pmr::deque<Loot>(std::move(*other.bag_), alloc))
+        , bag_capacity_(other.bag_capacity_), score_(other.score_){
     }
 
     int GetId() const{
@@ -184,12 +204,14 @@ public:
         return pos_;
     }
 
-    void SetSlotSpeed(const SpeedSignal::slot_type& slot) const{
-        speed_signal_.connect(slot);
+    void SetSpeedListener(SpeedListener listener){
+        speed_listener_ = std::move(listener);
     }
 
     void SetSpeed(const Speed& new_speed){
-        speed_signal_(new_speed);
+        if(speed_listener_){
+            speed_listener_(new_speed);
+        }
         speed_ = new_speed;
     }
 
@@ -249,7 +271,7 @@ private:
     Name name_;
     Position pos_;
     Speed speed_;
-    mutable SpeedSignal speed_signal_;
+    SpeedListener speed_listener_;
     Direction dir_;
     Bag bag_;
     unsigned bag_capacity_ = 0;
@@ -288,7 +310,7 @@ public:
     
     const LootTypes& GetLootTypes() const noexcept;
 
-    unsigned GetRandomLootType() const;
+    unsigned GetRandomLootType(util::Random& random) const;
 
     void AddRoad(const Road& road);
 
@@ -310,12 +332,27 @@ public:
 
     static PairDouble GetFirstPos(const model::Map::Roads& roads);
 
-    static PairDouble GetRandomPos(const model::Map::Roads& roads);
-private:
-    static unsigned GetRandomNumber(unsigned a, unsigned b){
-        return a + rand()%(b-a);
-    }
+    /* 
+        Строит таблицу выбора дорог, взвешенную по их длине.
+        Вызывается после загрузки всех дорог карты
+    */
+    void BuildSpawnTable();
 
+    /* Случайная точка, равномерно распределённая по всей дорожной сети */
+    PairDouble GetRandomPos(util::Random& random) const;
+
+    /*
+        Делит карту на count вертикальных полос.
+        Границы полос проходят по координатам x вертикальных дорог и подобраны так,
+        чтобы на каждую полосу приходилась примерно одинаковая длина дорог
+    */
+    void BuildRegions(size_t count);
+
+    size_t GetRegionsCount() const;
+
+    /* Номер полосы, в которую попадает координата x */
+    size_t FindRegion(double x) const;
+private:
     using OfficeIdToIndex = std::unordered_map<Office::Id, size_t, util::TaggedHasher<Office::Id>>;
 
     /* Поиск вертикальных дорог по x координате*/
@@ -329,6 +366,8 @@ private:
     Id id_;
     std::string name_;
     Roads roads_;
+    util::AliasTable road_spawn_table_;
+    std::vector<double> region_bounds_;
     RoadMap road_map_;
     Buildings buildings_;
     LootTypes loot_types_;
@@ -339,36 +378,91 @@ private:
     unsigned bag_capacity_;
 };
 
+/*
+    Игровая сессия владеет собственными источниками памяти:
+    пулом для долгоживущих сущностей (собаки, трофеи, рюкзаки)
+    и монотонной ареной для временных данных тика.
+    При завершении сессии память пула освобождается целиком
+*/
 class GameSession{
 public:
-    explicit GameSession(const Map* map)
-        : map_(map){
+    using Dogs = std::pmr::list<Dog>;
+    using LootObjects = std::pmr::list<Loot>;
+
+    GameSession(const Map* map, uint64_t seed, bool use_huge_pages = false)
+        : huge_page_resource_(use_huge_pages 
+            ? std::make_unique<util::HugePageResource>() 
+            : nullptr)
+        , entities_resource_(huge_page_resource_ 
+            ? huge_page_resource_.get() 
+            : std::pmr::get_default_resource())
+        , loot_(&entities_resource_), dogs_(&entities_resource_)
+        , map_(map), random_(seed){
     }
 
+    GameSession(const GameSession&) = delete;
+    GameSession& operator=(const GameSession&) = delete;
+
     Dog* AddDog(int id, const Dog::Name& name, const Dog::Position& pos, const Dog::Speed& vel, Direction dir);
 
     Dog* AddCreatedDog(Dog new_dog);
 
     const Map* GetMap() const;
 
-    std::list<Dog>& GetDogs();
+    /* Случайная точка на дорогах карты сессии */
+    PairDouble GetRandomPos();
+
+    Dogs& GetDogs();
 
-    const std::list<Dog>& GetDogs() const;
+    const Dogs& GetDogs() const;
 
     void UpdateLoot(unsigned loot_count);
 
-    void SetLootObjects(std::list<Loot> new_loot);
+    /* Сколько трофеев не хватает, чтобы их стало столько же, сколько собак */
+    unsigned GetLootShortage() const;
 
-    const std::list<Loot>& GetLootObjects() const;
+    void SetLootObjects(const std::list<Loot>& new_loot);
 
-    void DeleteCollectedLoot(const std::set<size_t>& collected_items);
+    const LootObjects& GetLootObjects() const;
+
+    void DeleteCollectedLoot(const std::pmr::set<size_t>& collected_items);
+
+    /* 
+        Сбрасывает арену временных данных и возвращает её.
+        Вызывается в начале каждого тика сессии
+    */
+    std::pmr::memory_resource* ResetTickScratch();
 
     void DeleteDog(const Dog* erasing_dog);
+
+    void SetLootGenerator(loot_gen::LootGenerator loot_generator, detail::Milliseconds now);
+
+    /* 
+        Планирует появление трофеев: возвращает момент игрового времени, 
+        не раньше min_delay от now, когда генератор выдаст трофеи,
+        либо nullopt, если при текущем числе собак и трофеев они не появятся.
+        Каждый вызов делает недействительными ранее выданные моменты
+    */
+    std::optional<detail::Milliseconds> ScheduleLoot(detail::Milliseconds now, 
+                                                    detail::Milliseconds min_delay = detail::Milliseconds{0});
+
+    /* Номер последнего планирования появления трофеев */
+    unsigned GetLootScheduleId() const;
+
+    /* Генерирует трофеи за время, прошедшее с прошлой генерации, и возвращает их количество */
+    unsigned GenerateLoot(detail::Milliseconds now);
 private:
+    std::unique_ptr<util::HugePageResource> huge_page_resource_;
+    std::pmr::unsynchronized_pool_resource entities_resource_;
+    util::ScratchArena tick_scratch_;
     unsigned auto_loot_counter_ = 0;
-    std::list<Loot> loot_;
-    std::list<Dog> dogs_;
+    LootObjects loot_;
+    Dogs dogs_;
     const Map* map_;
+    util::Random random_;
+    std::optional<loot_gen::LootGenerator> loot_generator_;
+    detail::Milliseconds last_loot_generation_{0};
+    unsigned loot_schedule_id_ = 0;
 };
 
 class Game {
@@ -399,6 +493,23 @@ public:
     void SetDogRetirementTime(unsigned dog_retirement_time);
     
     unsigned GetDogRetirementTime() const;
+
+    /* 
+        Задаёт зерно, из которого выводятся генераторы случайных чисел сессий.
+        Позволяет воспроизводить случайные позиции в бенчмарках
+    */
+    void SetRandomSeed(uint64_t seed);
+
+    /* Новые сессии будут размещать сущности в больших страницах памяти */
+    void SetHugePagesEnabled(bool enabled);
+
+    /*
+        Включает пространственную декомпозицию больших сессий:
+        карты делятся на regions полос, которые обрабатываются workers потоками.
+        Применяется к сессиям, где собак не меньше REGION_MIN_DOGS.
+        При workers == 0 режим выключается
+    */
+    void SetRegionDecomposition(unsigned workers, unsigned regions);
     
     const Maps& GetMaps() const noexcept;
 
@@ -406,17 +517,48 @@ public:
 
     detail::Milliseconds GetLootGeneratePeriod() const;
 
-    void GenerateLootInSessions(detail::Milliseconds delta);
+    /* 
+        Перепланирует появление трофеев в сессии.
+        Вызывается при каждом изменении числа собак или трофеев в ней
+    */
+    void ScheduleLootSpawn(GameSession* session);
 
     void UpdateGameState(unsigned delta);
 
     void DisconnectDogFromSession(const GameSession* player_session, const Dog* erasing_dog);
 private:
-    void UpdateAllDogsPositions(std::list<Dog>& dogs, const Map* map, double delta);
+    /* Запланированное появление трофеев в сессии */
+    struct LootSpawn{
+        detail::Milliseconds time;
+        GameSession* session;
+        unsigned schedule_id;
+
+        bool operator>(const LootSpawn& other) const{
+            return time > other.time;
+        }
+    };
+
+    using LootSpawnQueue = std::priority_queue<LootSpawn, std::vector<LootSpawn>, std::greater<LootSpawn>>;
+
+    void ScheduleLootSpawn(GameSession* session, detail::Milliseconds min_delay);
+
+    /* Генерирует трофеи только в тех сессиях, для которых наступил запланированный момент */
+    void SpawnScheduledLoot();
+
+    void UpdateAllDogsPositions(GameSession::Dogs& dogs, const Map* map, double delta, 
+                                std::pmr::memory_resource* scratch);
+
+    void UpdateDogPos(Dog& dog, const std::vector<const Road*>& roads, double delta, 
+                        std::pmr::memory_resource* scratch);
 
-    void UpdateDogPos(Dog& dog, const std::vector<const Road*>& roads, double delta);
+    void UpdateDogsLoot(GameSession& session, double delta, std::pmr::memory_resource* scratch);
 
-    void UpdateDogsLoot(GameSession& session, double delta);
+    /* 
+        Тик сессии с разбиением карты на полосы: события сбора ищутся 
+        и позиции собак обновляются по полосам параллельно,
+        а события применяются в хронологическом порядке, как в UpdateDogsLoot
+    */
+    void UpdateSessionByRegions(GameSession& session, double delta, std::pmr::memory_resource* scratch);
 
     static bool IsInsideRoad(const PairDouble& getting_pos, const Point& start, const Point& end);
 
@@ -424,9 +566,17 @@ private:
     SessionsByMapId map_id_to_sessions_;
     MapIdToIndex map_id_to_index_;
     std::optional<loot_gen::LootGenerator> loot_generator_;
+    detail::Milliseconds game_time_{0};
+    LootSpawnQueue loot_spawns_;
+    util::SplitMix64 session_seeds_{std::random_device{}()};
+    bool huge_pages_enabled_ = false;
+    std::unique_ptr<util::WorkerPool> region_workers_;
+    unsigned regions_count_ = 0;
+    std::deque<util::ScratchArena> region_scratch_;
     double default_dog_speed_ = 1.0;
     double default_bag_capacity_ = 3;
     static constexpr double road_offset_ = 0.4;
+    static constexpr size_t REGION_MIN_DOGS = 1024;
     unsigned dog_retirement_time_ = 60;
 };
 
@@ -79,7 +79,7 @@ public:
         , speed_(*(dog.GetSpeed()))
         , direction_(dog.GetDirection())
         , score_(dog.GetScore())
-        , bag_(*(dog.GetBag()))
+        , bag_((*dog.GetBag()).begin(), (*dog.GetBag()).end())
         , player_repr_(){
     }
 
@@ -160,7 +160,7 @@ public:
             std::list<Loot> loot;
             std::list<DogRepr> dogs_repr;
             for(const auto& session : sessions){
-                loot = session.GetLootObjects();
+                loot.assign(session.GetLootObjects().begin(), session.GetLootObjects().end());
                 for(const auto& dog : session.GetDogs()){
                     dogs_repr.emplace_back(DogRepr(dog));
 
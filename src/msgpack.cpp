@@ -0,0 +1,135 @@
+#include "msgpack.h"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace msgpack {
+
+namespace {
+
+/* Числа в MessagePack записываются в порядке big-endian */
+template<typename T>
+void AppendBigEndian(std::string& out, T value){
+    for(int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8){
+        out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> shift) & 0xff));
+    }
+}
+
+void AppendHeader(std::string& out, uint8_t marker){
+    out.push_back(static_cast<char>(marker));
+}
+
+void EncodeUint(uint64_t value, std::string& out){
+    if(value < 0x80){
+        AppendHeader(out, static_cast<uint8_t>(value));
+    } else if(value <= std::numeric_limits<uint8_t>::max()){
+        AppendHeader(out, 0xcc);
+        AppendBigEndian(out, static_cast<uint8_t>(value));
+    } else if(value <= std::numeric_limits<uint16_t>::max()){
+        AppendHeader(out, 0xcd);
+        AppendBigEndian(out, static_cast<uint16_t>(value));
+    } else if(value <= std::numeric_limits<uint32_t>::max()){
+        AppendHeader(out, 0xce);
+        AppendBigEndian(out, static_cast<uint32_t>(value));
+    } else {
+        AppendHeader(out, 0xcf);
+        AppendBigEndian(out, value);
+    }
+}
+
+void EncodeInt(int64_t value, std::string& out){
+    if(value >= 0){
+        return EncodeUint(static_cast<uint64_t>(value), out);
+    }
+    if(value >= -32){
+        AppendHeader(out, static_cast<uint8_t>(value));
+    } else if(value >= std::numeric_limits<int8_t>::min()){
+        AppendHeader(out, 0xd0);
+        AppendBigEndian(out, static_cast<uint8_t>(value));
+    } else if(value >= std::numeric_limits<int16_t>::min()){
+        AppendHeader(out, 0xd1);
+        AppendBigEndian(out, static_cast<uint16_t>(value));
+    } else if(value >= std::numeric_limits<int32_t>::min()){
+        AppendHeader(out, 0xd2);
+        AppendBigEndian(out, static_cast<uint32_t>(value));
+    } else {
+        AppendHeader(out, 0xd3);
+        AppendBigEndian(out, static_cast<uint64_t>(value));
+    }
+}
+
+void EncodeDouble(double value, std::string& out){
+    constexpr double INT32_BOUND = 2147483648.0;
+    if(std::trunc(value) == value && std::abs(value) < INT32_BOUND){
+        return EncodeInt(static_cast<int64_t>(value), out);
+    }
+    AppendHeader(out, 0xca);
+    AppendBigEndian(out, std::bit_cast<uint32_t>(static_cast<float>(value)));
+}
+
+/* Заголовок строки, массива или словаря: короткая форма, затем 16- и 32-битная длина */
+void EncodeLength(size_t length, uint8_t fix_marker, size_t fix_limit, uint8_t marker16, std::string& out){
+    if(length < fix_limit){
+        AppendHeader(out, static_cast<uint8_t>(fix_marker | length));
+    } else if(length <= std::numeric_limits<uint16_t>::max()){
+        AppendHeader(out, marker16);
+        AppendBigEndian(out, static_cast<uint16_t>(length));
+    } else {
+        AppendHeader(out, marker16 + 1);
+        AppendBigEndian(out, static_cast<uint32_t>(length));
+    }
+}
+
+void EncodeString(std::string_view value, std::string& out){
+    if(value.size() >= 32 && value.size() <= std::numeric_limits<uint8_t>::max()){
+        AppendHeader(out, 0xd9);
+        AppendBigEndian(out, static_cast<uint8_t>(value.size()));
+    } else {
+        EncodeLength(value.size(), 0xa0, 32, 0xda, out);
+    }
+    out.append(value);
+}
+
+} // namespace
+
+void Encode(const json::value& value, std::string& out){
+    switch(value.kind()){
+        case json::kind::null:
+            return AppendHeader(out, 0xc0);
+        case json::kind::bool_:
+            return AppendHeader(out, value.get_bool() ? 0xc3 : 0xc2);
+        case json::kind::int64:
+            return EncodeInt(value.get_int64(), out);
+        case json::kind::uint64:
+            return EncodeUint(value.get_uint64(), out);
+        case json::kind::double_:
+            return EncodeDouble(value.get_double(), out);
+        case json::kind::string:
+            return EncodeString(value.get_string(), out);
+        case json::kind::array:
+            EncodeLength(value.get_array().size(), 0x90, 16, 0xdc, out);
+            for(const json::value& item : value.get_array()){
+                Encode(item, out);
+            }
+            return;
+        case json::kind::object:
+            EncodeLength(value.get_object().size(), 0x80, 16, 0xde, out);
+            for(const json::key_value_pair& item : value.get_object()){
+                EncodeString(item.key(), out);
+                Encode(item.value(), out);
+            }
+            return;
+    }
+}
+
+std::string FromJson(std::string_view json_text){
+    std::string out;
+    // MessagePack-представление документа игры заметно короче его JSON
+    out.reserve(json_text.size() / 2);
+    Encode(json::parse(json_text), out);
+    return out;
+}
+
+} // namespace msgpack
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <boost/json.hpp>
+#include <string>
+#include <string_view>
+
+namespace msgpack {
+
+namespace json = boost::json;
+
+/* Тип содержимого ответов в формате MessagePack */
+inline constexpr std::string_view CONTENT_TYPE = "application/msgpack";
+
+/*
+    Кодирует JSON-значение в MessagePack и дописывает его в out.
+    Целые кодируются самой короткой формой. Дробные числа - координаты и скорости -
+    квантуются до float32: на картах игры это точность до десятитысячных долей клетки.
+    Дробные числа с целым значением кодируются как целые
+*/
+void Encode(const json::value& value, std::string& out);
+
+/* Перекодирует JSON-документ в MessagePack. Бросает исключение, если документ некорректен */
+std::string FromJson(std::string_view json_text);
+
+} // namespace msgpack
@@ -1,4 +1,4 @@
-#include <iomanip>
+#include <charconv>
 #include "player.h"
 
 namespace util {
@@ -16,6 +16,10 @@ namespace model{
 
 /* ------------------------ Players ----------------------------------- */
 
+void Players::Reserve(size_t players_count){
+    players_.reserve(players_count);
+}
+
 Player& Players::Add(int id, const Player::Name& name, Dog* dog, const GameSession* session){
     util::DogMapKey key = std::make_pair(dog->GetId(), session->GetMap()->GetId());
     Player player(id, name, dog, session);
@@ -48,6 +52,10 @@ void Players::DeletePlayer(const Player* erasing_player){
 
 /* ---------------------- PlayerTokens ------------------------------------- */
 
+void PlayerTokens::Reserve(size_t players_count){
+    token_to_player_.reserve(players_count);
+}
+
 Token PlayerTokens::AddPlayer(Player& player){
     auto [it, is_emplaced] = token_to_player_.emplace(GenerateToken(), &player);
     if(is_emplaced){
@@ -64,6 +72,7 @@ void PlayerTokens::AddPlayerWithToken(Player& player, Token token){
     if(!is_emplaced){
         throw std::logic_error("Player with this token has already been added");
     }
+    player.SetToken(it->first);
 }
 
 void PlayerTokens::AddPlayerInSession(Player& player, const GameSession* session){
@@ -96,6 +105,10 @@ const PlayerTokens::TokenToPlayer& PlayerTokens::GetAllTokens() const{
     return token_to_player_;
 }
 
+const PlayerTokens::SessionToPlayers& PlayerTokens::GetAllSessions() const{
+    return players_by_session_;
+}
+
 void PlayerTokens::DeletePlayer(const Player* erasing_player){
     /* Удаляем из хэш-таблицы с токенами */
     auto token_it = std::find_if(token_to_player_.begin(), 
@@ -116,10 +129,17 @@ void PlayerTokens::DeletePlayer(const Player* erasing_player){
 }
 
 Token PlayerTokens::GenerateToken() {
-    std::ostringstream out;
-    out << std::hex << std::setw(16) << std::setfill('0') << generator1_();
-    out << std::hex << std::setw(16) << std::setfill('0') << generator2_();
-    return Token(out.str());
+    /* Два 64-разрядных числа в hex, каждое дополнено нулями слева до 16 символов */
+    static constexpr size_t PART_SIZE = 16;
+    std::string token(2 * PART_SIZE, '0');
+    char* part_end = token.data();
+    for(uint64_t part : {generator1_(), generator2_()}){
+        part_end += PART_SIZE;
+        char buffer[PART_SIZE];
+        auto [end, ec] = std::to_chars(std::begin(buffer), std::end(buffer), part, 16);
+        std::copy(buffer, end, part_end - (end - buffer));
+    }
+    return Token(std::move(token));
 }
 
 } // namespace model
\ No newline at end of file
@@ -40,8 +40,8 @@ public:
         return dog_;
     }
 
-    void SetPlayerTimeClock(const Dog::SpeedSignal::slot_type& slot) const {
-        dog_->SetSlotSpeed(slot);
+    void SetPlayerTimeClock(Dog::SpeedListener listener) const {
+        dog_->SetSpeedListener(std::move(listener));
     }
 
     const Dog* GetDog() const{
@@ -81,6 +81,9 @@ public:
     using PlayerList = std::unordered_map<util::DogMapKey, Player, util::DogMapKeyHasher>;
     Players() = default;
 
+    /* Резервирует место под ожидаемое число игроков, чтобы массовый вход не вызывал перехеширования */
+    void Reserve(size_t players_count);
+
     Player& Add(int id, const Player::Name& name, Dog* dog, const GameSession* session);
 
     const Player* FindByDogIdAndMapId(int dog_id, std::string map_id) const;
@@ -101,6 +104,8 @@ public:
     using SessionToPlayers = std::unordered_map<const model::GameSession*, PlayersInSession>;
     PlayerTokens() = default;
 
+    void Reserve(size_t players_count);
+
     Token AddPlayer(Player& player);
 
     void AddPlayerWithToken(Player& player, Token token);
@@ -115,6 +120,8 @@ public:
 
     const TokenToPlayer& GetAllTokens() const;
 
+    const SessionToPlayers& GetAllSessions() const;
+
     void DeletePlayer(const Player* erasing_player);
 private:
     Token GenerateToken();
@@ -0,0 +1,160 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace util {
+
+/*
+    Генератор SplitMix64.
+    Используется для раскрутки зерна в состояние Xoshiro256
+    и для выдачи независимых зёрен игровым сессиям
+*/
+class SplitMix64 {
+public:
+    using result_type = uint64_t;
+
+    explicit SplitMix64(uint64_t seed) noexcept
+        : state_(seed) {
+    }
+
+    result_type operator()() noexcept {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t state_;
+};
+
+/*
+    Быстрый генератор псевдослучайных чисел xoshiro256**.
+    Не потокобезопасен: каждая сессия владеет своим экземпляром
+    и обращается к нему только внутри strand.
+    Удовлетворяет требованиям UniformRandomBitGenerator
+*/
+class Xoshiro256 {
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed) noexcept {
+        SplitMix64 seeder(seed);
+        for (uint64_t& s : state_) {
+            s = seeder();
+        }
+    }
+
+    static constexpr result_type min() noexcept {
+        return 0;
+    }
+
+    static constexpr result_type max() noexcept {
+        return UINT64_MAX;
+    }
+
+    result_type operator()() noexcept {
+        const uint64_t result = Rotl(state_[1] * 5, 7) * 9;
+        const uint64_t t = state_[1] << 17;
+
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = Rotl(state_[3], 45);
+
+        return result;
+    }
+
+    /* Равномерное число в диапазоне [0, 1) */
+    double NextDouble() noexcept {
+        return static_cast<double>((*this)() >> 11) * 0x1.0p-53;
+    }
+
+    /* Равномерное целое число в диапазоне [0, bound) */
+    uint64_t NextBelow(uint64_t bound) noexcept {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>((*this)()) * bound) >> 64);
+    }
+
+private:
+    static constexpr uint64_t Rotl(uint64_t x, int k) noexcept {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t state_[4];
+};
+
+using Random = Xoshiro256;
+
+/*
+    Таблица псевдонимов (метод Уолкера-Воуза).
+    Строится один раз по весам за O(n)
+    и выдаёт индекс с вероятностью, пропорциональной весу, за O(1)
+*/
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    explicit AliasTable(const std::vector<double>& weights) {
+        const std::size_t count = weights.size();
+        probability_.assign(count, 1.0);
+        alias_.resize(count);
+        if (count == 0) {
+            return;
+        }
+
+        double total = 0;
+        for (double weight : weights) {
+            total += weight;
+        }
+
+        /* Если все веса нулевые, индексы выбираются равновероятно */
+        std::vector<double> scaled(count, 1.0);
+        if (total > 0) {
+            for (std::size_t i = 0; i < count; ++i) {
+                scaled[i] = weights[i] * count / total;
+            }
+        }
+
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+        for (std::size_t i = 0; i < count; ++i) {
+            alias_[i] = static_cast<uint32_t>(i);
+            (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+        }
+
+        while (!small.empty() && !large.empty()) {
+            uint32_t less = small.back();
+            small.pop_back();
+            uint32_t more = large.back();
+
+            probability_[less] = scaled[less];
+            alias_[less] = more;
+
+            scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+            if (scaled[more] < 1.0) {
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+        /* Оставшиеся из-за погрешности вычислений индексы выбираются всегда */
+    }
+
+    bool IsEmpty() const noexcept {
+        return probability_.empty();
+    }
+
+    template <typename Generator>
+    std::size_t Sample(Generator& random) const noexcept {
+        std::size_t column = random.NextBelow(probability_.size());
+        return random.NextDouble() < probability_[column] ? column : alias_[column];
+    }
+
+private:
+    std::vector<double> probability_;
+    std::vector<uint32_t> alias_;
+};
+
+}  // namespace util
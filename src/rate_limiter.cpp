@@ -0,0 +1,73 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace rate_limiter {
+
+uint64_t MakeKey(std::string_view identity, uint32_t route){
+    uint64_t key = std::hash<std::string_view>{}(identity) ^ ((route + 1) * 0x9E3779B97F4A7C15ull);
+    return key == 0 ? 1 : key;
+}
+
+/* ------------------------ RateLimiter ----------------------------------- */
+
+RateLimiter::RateLimiter()
+    : epoch_(Clock::now())
+    , shards_(std::make_unique<Shard[]>(SHARDS)){
+}
+
+RateLimiter::Slot& RateLimiter::FindSlot(uint64_t key, uint64_t capacity, uint64_t now){
+    Shard& shard = shards_[key % SHARDS];
+    size_t start = (key / SHARDS) % SLOTS_PER_SHARD;
+
+    Slot* stalest = nullptr;
+    uint64_t stalest_stamp = std::numeric_limits<uint64_t>::max();
+    for(size_t i = 0; i < PROBE_LENGTH; ++i){
+        Slot& slot = shard.slots[(start + i) % SLOTS_PER_SHARD];
+        uint64_t slot_key = slot.key.load(std::memory_order_acquire);
+        if(slot_key == EMPTY_KEY){
+            // Занимаем свободную ячейку; если её успел занять другой поток, проверяем, не тем же ли ключом
+            if(slot.key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel)){
+                slot.state.store(Pack(capacity, now), std::memory_order_release);
+                return slot;
+            }
+        }
+        if(slot_key == key){
+            return slot;
+        }
+        if(uint64_t stamp = GetStamp(slot.state.load(std::memory_order_relaxed)); stamp < stalest_stamp){
+            stalest_stamp = stamp;
+            stalest = &slot;
+        }
+    }
+
+    // Свободных ячеек нет: вытесняем корзину, которой дольше всех не пользовались
+    stalest->key.store(key, std::memory_order_release);
+    stalest->state.store(Pack(capacity, now), std::memory_order_release);
+    return *stalest;
+}
+
+bool RateLimiter::TryAcquire(uint64_t key, const Policy& policy, Clock::time_point now){
+    const uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - epoch_).count();
+    const uint64_t capacity = std::min<uint64_t>(uint64_t{policy.burst} * MILLI, TOKENS_MASK);
+
+    Slot& slot = FindSlot(key, capacity, now_ms);
+    uint64_t state = slot.state.load(std::memory_order_acquire);
+    for(;;){
+        // За миллисекунду корзина пополняется на rate тысячных долей токена
+        uint64_t stamp = GetStamp(state);
+        uint64_t elapsed = now_ms > stamp ? now_ms - stamp : 0;
+        uint64_t tokens = std::min(capacity, GetTokens(state) + elapsed * policy.rate);
+        if(tokens < MILLI){
+            return false;
+        }
+        if(slot.state.compare_exchange_weak(state, Pack(tokens - MILLI, std::max(now_ms, stamp)),
+                                            std::memory_order_acq_rel)){
+            return true;
+        }
+    }
+}
+
+} // namespace rate_limiter
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace rate_limiter {
+
+using Clock = std::chrono::steady_clock;
+
+/* Параметры корзины токенов: скорость пополнения в токенах в секунду и ёмкость */
+struct Policy{
+    uint32_t rate = 0;
+    uint32_t burst = 0;
+};
+
+/* Ключ корзины: хэш идентичности клиента (токена или адреса), смешанный с номером маршрута */
+uint64_t MakeKey(std::string_view identity, uint32_t route);
+
+/* ------------------------ RateLimiter ----------------------------------- */
+
+/*
+    Ограничитель частоты запросов на корзинах токенов.
+    Корзины лежат в таблице фиксированного размера, разбитой на сегменты по хэшу ключа.
+    Ключ и состояние корзины - атомарные 64-битные слова, поэтому проверка не берёт блокировок
+    и безопасна из любого потока. Состояние упаковывает число токенов в тысячных долях
+    и время последнего пополнения в миллисекундах.
+    Если ячейки для ключа заняты, вытесняется корзина, дольше всех не пополнявшаяся
+*/
+class RateLimiter{
+public:
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t SLOTS_PER_SHARD = 4096;
+    static constexpr size_t PROBE_LENGTH = 8;
+
+    RateLimiter();
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    /* Забирает токен из корзины key. false - лимит исчерпан */
+    bool TryAcquire(uint64_t key, const Policy& policy, Clock::time_point now = Clock::now());
+private:
+    static constexpr uint64_t EMPTY_KEY = 0;
+    static constexpr uint64_t MILLI = 1000;
+    static constexpr unsigned TOKENS_BITS = 24;
+    static constexpr uint64_t TOKENS_MASK = (uint64_t{1} << TOKENS_BITS) - 1;
+
+    struct Slot{
+        std::atomic<uint64_t> key{EMPTY_KEY};
+        std::atomic<uint64_t> state{0};
+    };
+
+    // Сегмент выровнен по строке кэша, чтобы соседние сегменты не делили строки
+    struct alignas(64) Shard{
+        std::array<Slot, SLOTS_PER_SHARD> slots;
+    };
+
+    static uint64_t Pack(uint64_t milli_tokens, uint64_t stamp){
+        return (stamp << TOKENS_BITS) | (milli_tokens & TOKENS_MASK);
+    }
+
+    static uint64_t GetTokens(uint64_t state){
+        return state & TOKENS_MASK;
+    }
+
+    static uint64_t GetStamp(uint64_t state){
+        return state >> TOKENS_BITS;
+    }
+
+    Slot& FindSlot(uint64_t key, uint64_t capacity, uint64_t now);
+
+    Clock::time_point epoch_;
+    std::unique_ptr<Shard[]> shards_;
+};
+
+} // namespace rate_limiter
@@ -1,20 +1,13 @@
 #include "request_handler.h"
 #include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
 
 namespace request_handler {
 
 namespace detail{
 
-std::string ToLower(std::string_view str){
-    std::string result;
-    result.resize(str.size());
-    std::transform(str.begin(), str.end(), result.begin(), [](char c){
-        return std::tolower(c);
-    });
-
-    return result;
-}
-
 char FromHexToChar(char a, char b){
     a = std::tolower(a);
     b = std::tolower(b);
@@ -85,6 +78,60 @@ std::unordered_map<std::string, std::string> ParseTargetArgs(std::string_view re
     return args;
 }
 
+std::optional<uint64_t> FindUintArg(std::string_view req_target, std::string_view name){
+    size_t query = req_target.find('?');
+    while(query != req_target.npos){
+        std::string_view arg = req_target.substr(query + 1);
+        query = req_target.find('&', query + 1);
+        arg = arg.substr(0, arg.find('&'));
+        if(arg.size() > name.size() && arg.starts_with(name) && arg[name.size()] == '='){
+            arg.remove_prefix(name.size() + 1);
+            uint64_t value = 0;
+            auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+            if(ec != std::errc() || end != arg.data() + arg.size()){
+                return std::nullopt;
+            }
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+std::array<RouteLimits, API_ROUTES_COUNT> MakeRouteLimits(double scale){
+    auto apply = [scale](uint32_t value) -> uint32_t {
+        if(value == 0){
+            return 0;
+        }
+        double scaled = std::round(value * scale);
+        if(scaled >= std::numeric_limits<uint32_t>::max()){
+            return std::numeric_limits<uint32_t>::max();
+        }
+        return std::max<uint32_t>(1, static_cast<uint32_t>(scaled));
+    };
+
+    std::array<RouteLimits, API_ROUTES_COUNT> result;
+    for(size_t i = 0; i < API_ROUTES_COUNT; ++i){
+        RouteLimits limits = GetRouteLimits(static_cast<ApiRoute>(i));
+        for(rate_limiter::Policy* policy : {&limits.per_token, &limits.per_ip}){
+            policy->rate = apply(policy->rate);
+            policy->burst = apply(policy->burst);
+        }
+        result[i] = limits;
+    }
+    return result;
+}
+
+Format FindFormat(std::string_view accept){
+    if(accept.find("application/msgpack"sv) != accept.npos || accept.find("application/x-msgpack"sv) != accept.npos){
+        return Format::MSGPACK;
+    }
+    return Format::JSON;
+}
+
+std::string_view GetContentType(Format format){
+    return format == Format::MSGPACK ? msgpack::CONTENT_TYPE : "application/json"sv;
+}
+
 std::string MakeErrorCode(std::string_view code, std::string_view message){
     json::object body;
     body["code"] = std::string(code);
@@ -92,8 +139,55 @@ std::string MakeErrorCode(std::string_view code, std::string_view message){
     return json::serialize(body);
 }
 
-bool IsMatched(const std::string& str, std::string reg_expression){
-    return boost::regex_match(str, boost::regex(reg_expression));
+std::string MakeMetricsBody(const ApiMetrics& metrics, const admission::LoadMonitor& load_monitor,
+                            const PayloadCacheStats& cache_stats){
+    json::object rate_limited;
+    for(size_t i = 0; i < API_ROUTES_COUNT; ++i){
+        if(uint64_t count = metrics.rate_limited[i].load(std::memory_order_relaxed); count != 0){
+            rate_limited[GetRouteName(static_cast<ApiRoute>(i))] = count;
+        }
+    }
+
+    json::object body;
+    body["loopLagMs"] = load_monitor.GetLoopLag().count();
+    body["apiQueueDepth"] = load_monitor.GetQueueDepth();
+    body["shedRequests"] = metrics.shed_requests.load(std::memory_order_relaxed);
+    body["rateLimited"] = std::move(rate_limited);
+
+    json::object snapshot_cache;
+    snapshot_cache["hits"] = cache_stats.hits.load(std::memory_order_relaxed);
+    snapshot_cache["misses"] = cache_stats.misses.load(std::memory_order_relaxed);
+    body["snapshotCache"] = std::move(snapshot_cache);
+    return json::serialize(body);
+}
+
+/* ------------------------ TickWaiter ----------------------------------- */
+
+void TickWaiter::Start(SnapshotPtr current){
+    current_ = std::move(current);
+    timer_.expires_after(MAX_WAIT);
+    timer_.async_wait([self = shared_from_this()](sys::error_code ec){
+        if(!ec){
+            /* Тик так и не вышел: клиент получает состояние, которое у него уже есть */
+            self->Finish(self->current_);
+        }
+    });
+}
+
+void TickWaiter::OnSnapshot(const SnapshotUpdate& update){
+    Finish(update.GetSnapshot());
+}
+
+void TickWaiter::Finish(const SnapshotPtr& snapshot){
+    if(!respond_){
+        return;
+    }
+    /* Ответ отправляется один раз, после него подписка лишь ждёт удаления из реестра */
+    Respond respond = std::move(respond_);
+    respond_ = nullptr;
+    timer_.cancel();
+    respond(snapshot);
+    current_.reset();
 }
 
 } // namespace detail
@@ -123,15 +217,7 @@ StringResponse BaseHandler::MakeErrorResponse(http::status status, std::string_v
 /* -------------------------- FileHandler --------------------------------- */
 
 std::string FileHandler::GetRequiredContentType(std::string_view req_target){
-    auto point = req_target.find_last_of('.');
-    std::string extension;
-    if(point != req_target.npos){
-        extension = detail::ToLower(req_target.substr(point, req_target.npos));
-    }        
-    if(detail::FILES_EXTENSIONS.count(extension)){
-        return detail::FILES_EXTENSIONS.at(extension);
-    }
-    return "application/octet-stream";
+    return static_cache::FindContentType(req_target);
 }
 
 }  // namespace request_handler
@@ -1,16 +1,22 @@
 #pragma once
-#include <boost/regex.hpp>
 #define BOOST_BEAST_USE_STD_STRING_VIEW
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <iostream>
 #include "app.h"
+#include "admission.h"
+#include "rate_limiter.h"
 #include "cmd_parser.h"
+#include "static_cache.h"
+#include "sendfile_body.h"
+#include "game_socket.h"
 #include <iostream>
 #include <filesystem>
 #include <variant>
 #include <unordered_map>
 #include <optional>
+#include <array>
+#include <cstdint>
 
 namespace request_handler {
 
@@ -24,19 +30,6 @@ namespace fs = std::filesystem;
 
 namespace detail{
 
-static const std::unordered_map< std::string, std::string> 
-FILES_EXTENSIONS {
-        {".htm", "text/html"}, {".html", "text/html"}, {".css", "text/css"}, 
-        {".txt", "text/plain"}, {".js", "text/javascript"}, {".json", "application/json"}, 
-        {".xml", "application/xml"}, {".png", "image/png"}, {".jpg", "image/jpeg"}, 
-        {".jpe", "image/jpeg"}, {".jpeg", "image/jpeg"},  {".gif", "image/gif"},
-        {".bmp", "image/bmp"}, {".ico", "image/vnd.microsoft.icon"}, {".tiff", "image/tiff"}, 
-        {".tif", "image/tiff"},  {".svg", "image/svg+xml"},  {".svgz", "image/svg+xml"},
-        {".mp3", "audio/mpeg"}
-};
-
-std::string ToLower(std::string str);
-
 inline char FromHexToChar(char a, char b);
 
 std::string DecodeTarget(std::string_view req_target);
@@ -45,15 +38,322 @@ std::pair<std::string, std::string> ParseArg(std::string_view arg);
 
 std::unordered_map<std::string, std::string> ParseTargetArgs(std::string_view req_target);
 
+/* Целочисленный параметр name строки запроса без выделения памяти. nullopt - параметра нет или он не число */
+std::optional<uint64_t> FindUintArg(std::string_view req_target, std::string_view name);
+
+/* Формат ответа по заголовку Accept: MessagePack, если клиент его принимает, иначе JSON */
+Format FindFormat(std::string_view accept);
+
+std::string_view GetContentType(Format format);
+
 std::string MakeErrorCode(std::string_view code, std::string_view message);
 
-bool IsMatched(const std::string& str, std::string reg_expression);
+/* ------------------------ SetMethods ----------------------------------- */
+
+/*
+    Класс для формирования набора методов,
+    который передается в функции, проверяющие 
+    запросы на наличие определенных методов.
+    Набор хранится битовой маской и строится при компиляции
+*/
+class SetMethods{
+public:
+    template<typename... Verbs>
+    constexpr SetMethods(Verbs... verbs)
+        : mask_((ToBit(verbs) | ... | uint64_t{0})){
+    }
+
+    constexpr bool IsSame(http::verb verb) const{
+        return (mask_ & ToBit(verb)) != 0;
+    }
+
+    std::string MakeSequence() const{
+        std::string sequence;
+        for(unsigned i = 0; i < 64; ++i){
+            if(mask_ & (uint64_t{1} << i)){
+                if(!sequence.empty()){
+                    sequence += ", "sv;
+                }
+                sequence += http::to_string(static_cast<http::verb>(i));
+            }
+        }
+
+        return sequence;
+    }
+private:
+    static constexpr uint64_t ToBit(http::verb verb){
+        return uint64_t{1} << static_cast<unsigned>(verb);
+    }
+
+    uint64_t mask_;
+};
+
+inline constexpr SetMethods GET_HEAD_METHODS{http::verb::get, http::verb::head};
+inline constexpr SetMethods POST_METHODS{http::verb::post};
+
+/* ------------------------ ApiRoute ----------------------------------- */
+
+enum class ApiRoute{
+    MAPS_LIST,
+    MAP_DESCRIPTION,
+    JOIN,
+    PLAYERS,
+    STATE,
+    TICK,
+    ACTION,
+    RECORDS,
+    METRICS,
+    GAME_SOCKET,
+    UNKNOWN
+};
+
+inline constexpr size_t API_ROUTES_COUNT = static_cast<size_t>(ApiRoute::UNKNOWN) + 1;
+
+struct ApiRouteEntry{
+    std::string_view path;
+    ApiRoute route;
+};
+
+/* Маршруты, путь которых совпадает с запросом целиком (без строки параметров) */
+inline constexpr std::array<ApiRouteEntry, 9> EXACT_API_ROUTES{{
+    {"/api/v1/maps"sv, ApiRoute::MAPS_LIST},
+    {"/api/v1/game/join"sv, ApiRoute::JOIN},
+    {"/api/v1/game/players"sv, ApiRoute::PLAYERS},
+    {"/api/v1/game/state"sv, ApiRoute::STATE},
+    {"/api/v1/game/tick"sv, ApiRoute::TICK},
+    {"/api/v1/game/player/action"sv, ApiRoute::ACTION},
+    {"/api/v1/game/records"sv, ApiRoute::RECORDS},
+    {"/api/v1/metrics"sv, ApiRoute::METRICS},
+    {"/api/v1/game/socket"sv, ApiRoute::GAME_SOCKET},
+}};
+
+inline constexpr std::string_view MAP_DESCRIPTION_PREFIX = "/api/v1/maps/"sv;
+
+/* 
+    Под перегрузкой первыми отклоняются запросы, без которых игра продолжается:
+    таблица рекордов и список игроков
+*/
+constexpr admission::Priority GetRoutePriority(ApiRoute route){
+    switch(route){
+        case ApiRoute::RECORDS:
+        case ApiRoute::PLAYERS:
+            return admission::Priority::LOW;
+        default:
+            return admission::Priority::CRITICAL;
+    }
+}
+
+constexpr uint32_t HashPath(std::string_view path, uint32_t seed){
+    /* FNV-1a */
+    uint32_t hash = 2166136261u ^ seed;
+    for(char c : path){
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+    Совершенная хэш-таблица маршрутов.
+    Зерно хэша подбирается при компиляции так, чтобы все маршруты
+    попали в разные ячейки; если подобрать не удалось, программа не скомпилируется
+*/
+struct ApiRouteTable{
+    static constexpr size_t SLOTS = 16;
+    static constexpr int8_t EMPTY = -1;
+
+    uint32_t seed = 0;
+    std::array<int8_t, SLOTS> slots{};
+};
+
+constexpr ApiRouteTable MakeApiRouteTable(){
+    for(uint32_t seed = 0; seed < 1024; ++seed){
+        ApiRouteTable table{seed, {}};
+        table.slots.fill(ApiRouteTable::EMPTY);
+
+        bool is_perfect = true;
+        for(size_t i = 0; i < EXACT_API_ROUTES.size() && is_perfect; ++i){
+            int8_t& slot = table.slots[HashPath(EXACT_API_ROUTES[i].path, seed) % ApiRouteTable::SLOTS];
+            is_perfect = slot == ApiRouteTable::EMPTY;
+            slot = static_cast<int8_t>(i);
+        }
+        if(is_perfect){
+            return table;
+        }
+    }
+    throw std::logic_error("Perfect hash for API routes is not found");
+}
+
+inline constexpr ApiRouteTable API_ROUTE_TABLE = MakeApiRouteTable();
+
+/* Путь запроса без строки параметров */
+constexpr std::string_view GetTargetPath(std::string_view target){
+    return target.substr(0, target.find('?'));
+}
+
+/* Определяет маршрут запроса без выделения памяти */
+constexpr ApiRoute FindApiRoute(std::string_view target){
+    std::string_view path = GetTargetPath(target);
+
+    int8_t index = API_ROUTE_TABLE.slots[HashPath(path, API_ROUTE_TABLE.seed) % ApiRouteTable::SLOTS];
+    if(index != ApiRouteTable::EMPTY && EXACT_API_ROUTES[index].path == path){
+        return EXACT_API_ROUTES[index].route;
+    }
+
+    if(path.size() > MAP_DESCRIPTION_PREFIX.size() && path.starts_with(MAP_DESCRIPTION_PREFIX)){
+        return ApiRoute::MAP_DESCRIPTION;
+    }
+    return ApiRoute::UNKNOWN;
+}
+
+static_assert(FindApiRoute("/api/v1/game/state"sv) == ApiRoute::STATE);
+static_assert(FindApiRoute("/api/v1/game/records?start=0&maxItems=10"sv) == ApiRoute::RECORDS);
+static_assert(FindApiRoute("/api/v1/maps/map1"sv) == ApiRoute::MAP_DESCRIPTION);
+static_assert(FindApiRoute("/api/v1/maps/"sv) == ApiRoute::UNKNOWN);
+static_assert(FindApiRoute("/api/v1/game/"sv) == ApiRoute::UNKNOWN);
+static_assert(FindApiRoute("/api/v1/metrics"sv) == ApiRoute::METRICS);
+static_assert(FindApiRoute("/api/v1/game/socket"sv) == ApiRoute::GAME_SOCKET);
+
+/* Идентификатор карты из запроса описания карты: берётся из того же пути, что и маршрут */
+constexpr std::string_view GetMapIdFromTarget(std::string_view target){
+    return GetTargetPath(target).substr(MAP_DESCRIPTION_PREFIX.size());
+}
+
+static_assert(FindApiRoute("/api/v1/maps/map1?v=1"sv) == ApiRoute::MAP_DESCRIPTION);
+static_assert(GetMapIdFromTarget("/api/v1/maps/map1?v=1"sv) == "map1"sv);
+static_assert(GetMapIdFromTarget("/api/v1/maps/map1"sv) == "map1"sv);
+
+/* Имя маршрута в метриках */
+constexpr std::string_view GetRouteName(ApiRoute route){
+    switch(route){
+        case ApiRoute::MAPS_LIST: return "maps"sv;
+        case ApiRoute::MAP_DESCRIPTION: return "map"sv;
+        case ApiRoute::JOIN: return "join"sv;
+        case ApiRoute::PLAYERS: return "players"sv;
+        case ApiRoute::STATE: return "state"sv;
+        case ApiRoute::TICK: return "tick"sv;
+        case ApiRoute::ACTION: return "action"sv;
+        case ApiRoute::RECORDS: return "records"sv;
+        case ApiRoute::METRICS: return "metrics"sv;
+        case ApiRoute::GAME_SOCKET: return "socket"sv;
+        default: return "unknown"sv;
+    }
+}
+
+/* ------------------------ RouteLimits ----------------------------------- */
+
+/* 
+    Лимиты частоты маршрута: по токену игрока и по адресу клиента.
+    Нулевая скорость означает, что лимит не применяется
+*/
+struct RouteLimits{
+    rate_limiter::Policy per_token;
+    rate_limiter::Policy per_ip;
+};
+
+/* 
+    Клиент игры опрашивает состояние и шлёт действия десятки раз в секунду,
+    лимиты по токену оставляют запас над этой частотой.
+    Лимит по адресу выше: за одним адресом может быть несколько игроков
+*/
+constexpr RouteLimits GetRouteLimits(ApiRoute route){
+    switch(route){
+        case ApiRoute::STATE:
+        case ApiRoute::PLAYERS:
+        case ApiRoute::ACTION:
+            return {{30, 60}, {300, 600}};
+        case ApiRoute::JOIN:
+        case ApiRoute::GAME_SOCKET:
+            return {{}, {10, 20}};
+        case ApiRoute::RECORDS:
+        case ApiRoute::METRICS:
+            return {{}, {5, 10}};
+        case ApiRoute::MAPS_LIST:
+        case ApiRoute::MAP_DESCRIPTION:
+            return {{}, {50, 100}};
+        default:
+            return {};
+    }
+}
+
+/* Лимиты всех маршрутов, умноженные на scale. Ненулевой лимит после умножения остаётся не меньше 1 */
+std::array<RouteLimits, API_ROUTES_COUNT> MakeRouteLimits(double scale);
+
+/* Длина токена игрока: 32 шестнадцатеричных символа */
+inline constexpr size_t TOKEN_SIZE = 32;
+
+/* Токен из заголовка Authorization: Bearer <token>, без проверки формата */
+template<typename Request>
+std::string_view FindBearerToken(const Request& req){
+    auto it = req.find(http::field::authorization);
+    if(it == req.end() || it->value().size() <= 7){
+        return {};
+    }
+    return it->value().substr(7);
+}
+
+/* Сравнение секрета за время, не зависящее от места первого различия */
+inline bool EqualsConstantTime(std::string_view lhs, std::string_view rhs){
+    if(lhs.size() != rhs.size()){
+        return false;
+    }
+    unsigned char diff = 0;
+    for(size_t i = 0; i < lhs.size(); ++i){
+        diff |= static_cast<unsigned char>(lhs[i] ^ rhs[i]);
+    }
+    return diff == 0;
+}
+
+/* ------------------------ ApiMetrics ----------------------------------- */
+
+/* Счётчики отказов обработчика запросов, читаются эндпоинтом метрик из любого потока */
+struct ApiMetrics{
+    std::atomic<uint64_t> shed_requests{0};
+    std::array<std::atomic<uint64_t>, API_ROUTES_COUNT> rate_limited{};
+};
+
+std::string MakeMetricsBody(const ApiMetrics& metrics, const admission::LoadMonitor& load_monitor,
+                            const PayloadCacheStats& cache_stats);
+
+/* ------------------------ TickWaiter ----------------------------------- */
+
+/*
+    Запрос состояния ?waitForTick=<version>, припаркованный до следующей публикации снимка сессии.
+    Поток не блокируется: ожидание - это подписка на снимки и таймер в strand.
+    Отвечает ровно один раз: новым снимком или, по истечении MAX_WAIT, последним известным
+*/
+class TickWaiter : public SnapshotSubscriber, public std::enable_shared_from_this<TickWaiter>{
+public:
+    using Respond = std::function<void(const SnapshotPtr& snapshot)>;
+
+    static constexpr std::chrono::seconds MAX_WAIT{30};
+
+    TickWaiter(Strand& strand, Respond respond)
+        : timer_{strand}
+        , respond_{std::move(respond)}{
+    }
+
+    /* Вызывается внутри strand после подписки. current - снимок, который уже есть у клиента */
+    void Start(SnapshotPtr current);
+
+    void OnSnapshot(const SnapshotUpdate& update) override;
+private:
+    void Finish(const SnapshotPtr& snapshot);
+
+    net::steady_timer timer_;
+    Respond respond_;
+    SnapshotPtr current_;
+};
 
 }; // namespace detail
 
 using StringResponse = http::response<http::string_body>;
 using FileResponse = http::response<http::file_body>;
-using VariantResponse = std::variant<StringResponse, FileResponse>;
+using AssetResponse = http::response<static_cache::SharedBufferBody>;
+using PartialAssetResponse = http::response<static_cache::SharedPartsBody>;
+using SendfileResponse = http::response<sendfile_body::SendfileBody>;
+using VariantResponse = std::variant<StringResponse, FileResponse, AssetResponse, PartialAssetResponse, SendfileResponse>;
+/* Ответы API: кэшируемые тела отдаются через AssetResponse без копирования */
+using ApiResponse = std::variant<StringResponse, AssetResponse>;
 
 /* 
     Предварительное объявление 
@@ -83,61 +383,29 @@ protected:
 class ApiHandler : public BaseHandler{
     friend class RequestHandler;
     
-    /*
-    Класс для формирования набора методов,
-    который передается в функции, проверяющие 
-    запросы на наличие определенных методов
-    */
-    class SetMethods{
-    public:
-        template<typename... Args>
-        SetMethods(Args&&... args){
-            (methods_.insert(std::forward<Args>(args)), ...);
-        }
-
-        bool IsSame(const std::string& other) const{
-            return methods_.count(other);
-        }
-
-        std::string MakeSequence() const{
-            std::ostringstream oss;
-            bool is_first = true;
-            for(const auto& method : methods_){
-                if(!is_first){
-                    oss << ", ";
-                }
-                is_first = false;
-                oss << method;
-            }
-
-            return oss.str();
-        }
-    private:
-        std::set<std::string> methods_;
-    };
 
 public:
     template<typename Request>
-    StringResponse MakeApiResponse(Request&& req){
-        std::string target = std::string(req.target());
-        if(detail::IsMatched(target, "(/api/v1/maps)"s)){
-            return MakeMapsListsResponse(req);
-        } else if(detail::IsMatched(target, "(/api/v1/maps/).+"s)) {
-            return MakeMapDescResponse(req);
-        } else if(detail::IsMatched(target, "(/api/v1/game/).*"s)){
-            if(detail::IsMatched(target, "(/api/v1/game/join)"s)){
+    ApiResponse MakeApiResponse(Request&& req){
+        switch(detail::FindApiRoute(req.target())){
+            case detail::ApiRoute::MAPS_LIST:
+                return MakeMapsListsResponse(req);
+            case detail::ApiRoute::MAP_DESCRIPTION:
+                return MakeMapDescResponse(req);
+            case detail::ApiRoute::JOIN:
                 return MakeAuthResponse(req);
-            } else if(detail::IsMatched(target, "(/api/v1/game/players)"s)) {
+            case detail::ApiRoute::PLAYERS:
                 return MakePlayerListResponse(req);
-            } else if(detail::IsMatched(target, "(/api/v1/game/state)"s)) {
+            case detail::ApiRoute::STATE:
                 return MakeGameStateResponse(req);
-            } else if(detail::IsMatched(target, "(/api/v1/game/tick)"s)){
+            case detail::ApiRoute::TICK:
                 return MakeIncreaseTimeResponse(req);
-            } else if(detail::IsMatched(target, "(/api/v1/game/player/action)"s)){
+            case detail::ApiRoute::ACTION:
                 return MakeActionResponse(req);
-            } else if(detail::IsMatched(target, "(/api/v1/game/records).*"s)){
+            case detail::ApiRoute::RECORDS:
                 return MakeRecordsResponse(req);
-            }
+            default:
+                break;
         }
         auto res = MakeErrorResponse(http::status::bad_request, "badRequest"sv, "Bad request"sv, req.version());
         return res;
@@ -151,6 +419,10 @@ public:
         app_.LoadState();
     }
 
+    void ReservePlayers(size_t players_count){
+        app_.ReservePlayers(players_count);
+    }
+
 private:
     explicit ApiHandler(model::Game& game, Strand api_strand, 
                         std::optional<unsigned> tick_period, 
@@ -192,40 +464,33 @@ private:
     }
 
     template<typename Request>
-    StringResponse MakeMapsListsResponse(Request&& req){
+    ApiResponse MakeMapsListsResponse(Request&& req){
         using namespace std::literals;
 
-        SetMethods methods("GET", "HEAD");
-        std::string method = std::string(req.method_string());
-        if(methods.IsSame(method)){
-            std::string body = app_.GetMapsList();
-            return MakeResponse(http::status::ok, body, 
-                                        req.version(), body.size(), "application/json"s);
+        const detail::SetMethods& methods = detail::GET_HEAD_METHODS;
+        if(methods.IsSame(req.method())){
+            Format format = detail::FindFormat(req[http::field::accept]);
+            compression::Coding coding = static_cache::SelectCoding(req[http::field::accept_encoding]);
+            return MakeEncodedResponse(req, app_.GetMapsList(format, coding), format);
         } else{
             auto res =  MakeErrorResponse(http::status::method_not_allowed, 
                 "invalidMethod"sv, "Only GET method is expected"sv, req.version());
             res.insert("Allow"s, methods.MakeSequence());
             return res;
         }
-
-        std::string body = app_.GetMapsList();
-        return MakeResponse(http::status::ok, body, 
-                                        req.version(), body.size(), "application/json"s);
     }
 
     template<typename Request>
-    StringResponse MakeMapDescResponse(Request&& req){
+    ApiResponse MakeMapDescResponse(Request&& req){
         using namespace std::literals;
 
-        SetMethods methods("GET", "HEAD");
-        std::string method = std::string(req.method_string());
-        if(methods.IsSame(method)){
-            std::string req_target = std::string(req.target());
-            model::Map::Id id(std::string(req_target.substr(13, req_target.npos)));
+        const detail::SetMethods& methods = detail::GET_HEAD_METHODS;
+        if(methods.IsSame(req.method())){
+            model::Map::Id id(std::string(detail::GetMapIdFromTarget(req.target())));
             if(auto map = app_.FindMap(id); map){
-                std::string body = app_.GetMapDescription(map);
-                return MakeResponse(http::status::ok, body, 
-                                        req.version(), body.size(), "application/json"s);
+                Format format = detail::FindFormat(req[http::field::accept]);
+                compression::Coding coding = static_cache::SelectCoding(req[http::field::accept_encoding]);
+                return MakeEncodedResponse(req, app_.GetMapDescription(map, format, coding), format);
             }
 
             return MakeErrorResponse(http::status::not_found, 
@@ -240,9 +505,8 @@ private:
 
     template<typename Request>
     StringResponse MakeAuthResponse(Request&& req){
-        SetMethods methods("POST");
-        std::string method = std::string(req.method_string());
-        if(methods.IsSame(method)){
+        const detail::SetMethods& methods = detail::POST_METHODS;
+        if(methods.IsSame(req.method())){
             if(req.at(http::field::content_type) == "application/json"sv){
                 json::object body;
                 try{
@@ -289,9 +553,8 @@ private:
         с переданным ей запросом.
     */
     template <typename Request, typename Fn>
-    StringResponse ExecuteAuthorized(const SetMethods& methods, Request&& req, Fn&& action) {
-        std::string method = std::string(req.method_string());
-        if(methods.IsSame(method)){
+    StringResponse ExecuteAuthorized(const detail::SetMethods& methods, Request&& req, Fn&& action) {
+        if(methods.IsSame(req.method())){
             auto it = req.find(http::field::authorization);
             try{
                 if(it != req.end()){
@@ -323,26 +586,125 @@ private:
         return res;
     }
 
+    /*
+        Аналог ExecuteAuthorized для чтения состояния сессии.
+        Токен ищется среди опубликованных снимков, 
+        поэтому метод безопасно вызывать вне strand.
+        Функция action получает снимок сессии игрока, 
+        тела ответов ссылаются на его строки без копирования
+    */
+    template <typename Request, typename Fn>
+    ApiResponse ExecuteWithSnapshot(const detail::SetMethods& methods, Request&& req, Fn&& action) {
+        if(methods.IsSame(req.method())){
+            auto it = req.find(http::field::authorization);
+            try{
+                if(it != req.end()){
+                    std::string_view req_token = it->value();
+                    Token token(std::string(req_token.substr(7, req_token.npos)));
+                    if((*token).size() != 32){
+                        throw std::logic_error("Incorrect token");
+                    }
+
+                    if(SnapshotPtr snapshot = app_.FindSnapshotByToken(token); snapshot){
+                        /* Запрос без ошибок */
+                        ApiResponse res = action(req, snapshot);
+                        std::visit([&snapshot](auto& response){
+                            response.set("X-Snapshot-Version"sv, std::to_string(snapshot->version));
+                        }, res);
+                        return res;
+                    }
+
+                    return MakeErrorResponse(http::status::unauthorized, 
+                        "unknownToken"sv, "Player token has not been found"sv, req.version());
+                } else {
+                    throw std::logic_error("Token is missing");
+                }
+            } catch(...){
+                return MakeErrorResponse(http::status::unauthorized, 
+                    "invalidToken"sv, "Authorization header is missing"sv, req.version());
+            }
+        }
+
+        auto res =  MakeErrorResponse(http::status::method_not_allowed, 
+            "invalidMethod"sv, "Invalid method"sv, req.version());
+        res.insert("Allow"s, methods.MakeSequence());
+        return res;
+    }
+
+    /* 
+        Ответы на чтение состояния сессии, 
+        формируемые из снимка без захода в strand
+    */
     template<typename Request>
-    StringResponse MakePlayerListResponse(Request&& req){
-        SetMethods available_methods("GET", "HEAD");
-        return ExecuteAuthorized(available_methods, req, [this](Request&& req, const Token& token){
-                std::string body = this->app_.GetPlayerList(token);
-                return this->MakeResponse(http::status::ok, body, req.version(), body.size(), 
-                    "application/json"s);
+    ApiResponse MakeSnapshotResponse(Request&& req){
+        if(detail::FindApiRoute(req.target()) == detail::ApiRoute::PLAYERS) {
+            return MakePlayerListResponse(req);
+        }
+        return MakeGameStateResponse(req);
+    }
+
+    template<typename Request>
+    ApiResponse MakePlayerListResponse(Request&& req){
+        return ExecuteWithSnapshot(detail::GET_HEAD_METHODS, req, [this](Request&& req, const SnapshotPtr& snapshot){
+                Format format = detail::FindFormat(req[http::field::accept]);
+                compression::Coding coding = static_cache::SelectCoding(req[http::field::accept_encoding]);
+                return this->MakeEncodedResponse(req, GetPlayersPayload(snapshot, format, coding), format);
         });
     }
 
+    /* 
+        Ответ с состоянием сессии из уже найденного снимка.
+        С параметром ?since=<version> отдаётся только разность от этой версии,
+        а если клиент отстал больше, чем хранит снимок, - полное состояние
+    */
     template<typename Request>
-    StringResponse MakeGameStateResponse(Request&& req){
-        SetMethods available_methods("GET", "HEAD");
-        return ExecuteAuthorized(available_methods, req, [this](Request&& req, const Token& token){
-                std::string body = this->app_.GetGameState(token);
-                return this->MakeResponse(http::status::ok, body, req.version(), body.size(), 
-                    "application/json"s);
+    ApiResponse MakeGameStateResponse(const Request& req, const SnapshotPtr& snapshot){
+        Format format = detail::FindFormat(req[http::field::accept]);
+        compression::Coding coding = static_cache::SelectCoding(req[http::field::accept_encoding]);
+        EncodedBody body = GetStatePayload(snapshot, detail::FindUintArg(req.target(), "since"sv), format, coding);
+        AssetResponse res = MakeEncodedResponse(req, std::move(body), format);
+        res.set("X-Snapshot-Version"sv, std::to_string(snapshot->version));
+        return res;
+    }
+
+    template<typename Request>
+    ApiResponse MakeGameStateResponse(Request&& req){
+        return ExecuteWithSnapshot(detail::GET_HEAD_METHODS, req, [this](Request&& req, const SnapshotPtr& snapshot){
+                return this->MakeGameStateResponse(req, snapshot);
         });
     }
 
+    /* 
+        Ответ в формате, выбранном по Accept, и со сжатием, выбранным по Accept-Encoding:
+        кэши различают такие ответы по заголовку Vary.
+        Для тела с ETag запрос с совпадающим If-None-Match получает 304 без тела,
+        а на HEAD отправляются только заголовки готового тела
+    */
+    template<typename Request>
+    AssetResponse MakeEncodedResponse(const Request& req, EncodedBody body, Format format){
+        AssetResponse res(http::status::ok, req.version());
+        res.set(http::field::content_type, detail::GetContentType(format));
+        res.set(http::field::cache_control, "no-cache"sv);
+        res.set(http::field::vary, "Accept, Accept-Encoding"sv);
+        if(!body.etag.empty()){
+            res.set(http::field::etag, body.etag);
+            if(auto it = req.find(http::field::if_none_match); 
+                    it != req.end() && static_cache::MatchesEtag(it->value(), body.etag)){
+                res.result(http::status::not_modified);
+                return res;
+            }
+        }
+        if(body.coding != compression::Coding::IDENTITY){
+            res.set(http::field::content_encoding, compression::GetName(body.coding));
+        }
+
+        res.content_length(body.data->size());
+        if(req.method() != http::verb::head){
+            res.body() = std::move(body.data);
+        }
+        return res;
+    }
+
     template<typename Request>
     StringResponse MakeIncreaseTimeResponse(Request&& req){
         if(app_.IsPeriodicMode()){
@@ -384,8 +746,7 @@ private:
                     json::object action = json::parse(req.body()).as_object();
                     if(auto it = action.find("move"); it != action.end()){
                         /* Запрос без ошибок */
-                        SetMethods available_methods("POST");
-                        return ExecuteAuthorized(available_methods, req, [this, &action](Request&& req, const Token& token){
+                        return ExecuteAuthorized(detail::POST_METHODS, req, [this, &action](Request&& req, const Token& token){
                             std::string body = this->app_.ApplyPlayerAction(action, token);
                             return this->MakeResponse(http::status::ok, body, req.version(), body.size(), 
                             "application/json"s);
@@ -408,9 +769,8 @@ private:
 
     template<typename Request>
     StringResponse MakeRecordsResponse(Request&& req){
-        SetMethods methods("GET", "HEAD");
-        std::string method = std::string(req.method_string());
-        if(methods.IsSame(method)){
+        const detail::SetMethods& methods = detail::GET_HEAD_METHODS;
+        if(methods.IsSame(req.method())){
             std::string target = std::string(req.target());
             
             unsigned start = 0;
@@ -457,12 +817,25 @@ public:
             req.target("/index.html");
         }
 
+        /* Файлы из манифеста отдаются из памяти без обращения к диску */
+        std::string_view target = req.target();
+        std::string asset_path = detail::DecodeTarget(target.substr(1, target.find('?') - 1));
+        static_cache::StaticCache::ManifestPtr manifest = cache_->GetManifest();
+        if(auto it = manifest->find(asset_path); it != manifest->end()){
+            return MakeAssetResponse(req, it->second);
+        }
+
         http::file_body::value_type file;
         std::string uncoded_target = detail::DecodeTarget(req.target().substr(1));
         std::string content_type = GetRequiredContentType(req.target());
 
         fs::path required_path(uncoded_target);
         fs::path summary_path = fs::weakly_canonical(static_path_ / required_path);
+        /* Крупные файлы и запросы диапазонов отдаются через sendfile */
+        bool has_range = req.find(http::field::range) != req.end();
+        if (std::error_code ec; (has_range || fs::file_size(summary_path, ec) >= static_cache::StaticCache::MIN_SENDFILE_SIZE) && !ec) {
+            return MakeSendfileResponse(req, summary_path, content_type);
+        }
         if (sys::error_code ec; file.open(summary_path.string().data(), beast::file_mode::read, ec), ec) {
             std::string empty_body;
             return MakeResponse(http::status::not_found, empty_body,  
@@ -481,12 +854,139 @@ public:
     }
 private:
     explicit FileHandler(fs::path static_path)
-        : static_path_(fs::canonical(static_path)){
+        : static_path_(fs::canonical(static_path))
+        , cache_(std::make_unique<static_cache::StaticCache>(static_path_)){
+        cache_->StartWatching();
+    }
+
+    template<typename Request>
+    VariantResponse MakeAssetResponse(const Request& req, const static_cache::Asset& asset){
+        AssetResponse response(http::status::ok, req.version());
+        response.set(http::field::content_type, asset.content_type);
+        response.set(http::field::etag, asset.etag);
+        response.set(http::field::accept_ranges, "bytes"sv);
+        response.set(http::field::cache_control, asset.immutable ? static_cache::IMMUTABLE_CACHE_CONTROL : "no-cache"sv);
+        if(asset.gzip_data){
+            response.set(http::field::vary, "Accept-Encoding"sv);
+        }
+
+        if(auto it = req.find(http::field::if_none_match); 
+                it != req.end() && static_cache::MatchesEtag(it->value(), asset.etag)){
+            response.result(http::status::not_modified);
+            return response;
+        }
+
+        if(!asset.data){
+            SendfileResponse file_response = MakeSendfileResponse(req, asset.path, asset.content_type, asset.etag);
+            file_response.set(http::field::cache_control, response[http::field::cache_control]);
+            return file_response;
+        }
+
+        /* Диапазоны отдаются из несжатого варианта, части ссылаются на буфер манифеста */
+        if(auto ranges = GetRequestedRanges(req, asset.data->size(), asset.etag)){
+            PartialAssetResponse partial(http::status::partial_content, req.version());
+            for(const auto& field : response){
+                partial.set(field.name(), field.value());
+            }
+            auto parts = ApplyRanges(partial, *ranges, asset.content_type, asset.data->size());
+            partial.content_length(sendfile_body::PartsSize(parts));
+            if(partial.result() == http::status::partial_content){
+                partial.body() = {asset.data, std::move(parts)};
+            }
+            return partial;
+        }
+
+        const static_cache::Asset::Buffer* data = &asset.data;
+        if(auto it = req.find(http::field::accept_encoding); 
+                asset.gzip_data && it != req.end() && static_cache::AcceptsGzip(it->value())){
+            response.set(http::field::content_encoding, "gzip"sv);
+            data = &asset.gzip_data;
+        }
+
+        response.content_length((*data)->size());
+        if(req.method() != http::verb::head){
+            response.body() = *data;
+        }
+        return response;
+    }
+
+    /*
+        Диапазоны, запрошенные заголовками Range и If-Range.
+        std::nullopt - отдаётся весь файл, пустой вектор - ни один диапазон не удовлетворим
+    */
+    template<typename Request>
+    std::optional<std::vector<static_cache::ByteRange>> GetRequestedRanges(const Request& req, uint64_t size,
+                                                                           std::string_view etag){
+        auto range = req.find(http::field::range);
+        if(req.method() != http::verb::get || range == req.end()){
+            return std::nullopt;
+        }
+        if(auto if_range = req.find(http::field::if_range); 
+                if_range != req.end() && !static_cache::IfRangeMatches(if_range->value(), etag)){
+            return std::nullopt;
+        }
+        return static_cache::ParseRange(range->value(), size);
+    }
+
+    /* Заполняет статус и заголовки ответа 206 или 416 и возвращает части тела */
+    template<typename Response>
+    std::vector<sendfile_body::Part> ApplyRanges(Response& response, const std::vector<static_cache::ByteRange>& ranges,
+                                                 std::string_view content_type, uint64_t size){
+        if(ranges.empty()){
+            response.result(http::status::range_not_satisfiable);
+            response.set(http::field::content_range, "bytes */"s + std::to_string(size));
+            return {};
+        }
+
+        response.result(http::status::partial_content);
+        if(ranges.size() == 1){
+            response.set(http::field::content_range, static_cache::MakeContentRange(ranges.front(), size));
+        } else {
+            response.set(http::field::content_type, 
+                         "multipart/byteranges; boundary="s + std::string(static_cache::BYTERANGES_BOUNDARY));
+        }
+        return static_cache::MakeRangeParts(ranges, content_type, size);
+    }
+
+    /* Крупный файл отправляется сессией через sendfile, в памяти сервера он не копируется */
+    template<typename Request>
+    SendfileResponse MakeSendfileResponse(const Request& req, const fs::path& path, std::string_view content_type,
+                                          std::string_view etag = {}){
+        SendfileResponse response(http::status::ok, req.version());
+        response.set(http::field::content_type, content_type);
+        response.set(http::field::accept_ranges, "bytes"sv);
+        if(!etag.empty()){
+            response.set(http::field::etag, etag);
+        }
+
+        sendfile_body::SendfileBody::value_type file;
+        if(beast::error_code ec; file.Open(path.c_str(), ec), ec){
+            response.result(http::status::not_found);
+            response.set(http::field::content_type, "text/plain"sv);
+            response.content_length(0);
+            return response;
+        }
+
+        if(auto ranges = GetRequestedRanges(req, file.GetFileSize(), etag)){
+            auto parts = ApplyRanges(response, *ranges, content_type, file.GetFileSize());
+            if(response.result() == http::status::range_not_satisfiable){
+                response.content_length(0);
+                return response;
+            }
+            file.SetParts(std::move(parts));
+        }
+
+        response.content_length(file.GetSize());
+        if(req.method() != http::verb::head){
+            response.body() = std::move(file);
+        }
+        return response;
     }
 
     std::string GetRequiredContentType(std::string_view req_target);
 
     fs::path static_path_;
+    std::unique_ptr<static_cache::StaticCache> cache_;
 };
 
 /* ------------------------- RequestHandler ---------------------------------- */
@@ -496,27 +996,89 @@ public:
     explicit RequestHandler(model::Game& game, const cmd_parser::Args& args, Strand api_strand, DatabaseManagerPtr&& db_manager)
         : game_{game}, 
         api_handler_{game, api_strand, args.tick_period, args.state_file, args.save_state_period, args.randomize_spawn_points, std::move(db_manager)},
-        file_handler_{args.www_root}{}
+        file_handler_{args.www_root},
+        load_monitor_{std::make_shared<admission::LoadMonitor>(api_strand.get_inner_executor(), MakeLimits(args))},
+        rate_limit_{args.rate_limit},
+        metrics_token_{args.metrics_token},
+        route_limits_{detail::MakeRouteLimits(args.rate_limit_scale)}{
+            load_monitor_->Start();
+        }
 
     RequestHandler(const RequestHandler&) = delete;
     RequestHandler& operator=(const RequestHandler&) = delete;
 
     template<typename Request, typename Send>
-    void operator()(Request&& req, Send&& send) {
-        // Обработать запрос request и отправить ответ, используя send
+    void operator()(Request&& req, const net::ip::address& remote_address, Send&& send) {
+        // Обработать запрос request от клиента remote_address и отправить ответ, используя send
     
+        /* 
+            Чтение состояния сессии обслуживается из опубликованного снимка
+            прямо в потоке ввода-вывода, не сериализуясь на strand
+        */
+        detail::ApiRoute route = detail::FindApiRoute(req.target());
+        if(!load_monitor_->Admit(detail::GetRoutePriority(route))){
+            /* Перегрузка: запрос отклоняется до обращения к модели */
+            auto res = api_handler_.MakeErrorResponse(http::status::service_unavailable, 
+                "serviceUnavailable"sv, "Server is overloaded, try again later"sv, req.version());
+            res.set(http::field::retry_after, std::to_string(load_monitor_->GetRetryAfter().count()));
+            metrics_.shed_requests.fetch_add(1, std::memory_order_relaxed);
+            return send(std::move(res));
+        }
+        if(rate_limit_ && !CheckRateLimits(route, req, remote_address)){
+            /* Лимит частоты исчерпан: запрос не доходит ни до модели, ни до strand */
+            auto res = api_handler_.MakeErrorResponse(http::status::too_many_requests, 
+                "tooManyRequests"sv, "Request rate limit exceeded"sv, req.version());
+            res.set(http::field::retry_after, "1"sv);
+            metrics_.rate_limited[static_cast<size_t>(route)].fetch_add(1, std::memory_order_relaxed);
+            return send(std::move(res));
+        }
+        if(route == detail::ApiRoute::METRICS){
+            /* Метрики раскрывают нагрузку сервера: без --metrics-token эндпоинта нет, иначе нужен токен */
+            if(!metrics_token_){
+                return send(api_handler_.MakeErrorResponse(http::status::bad_request, 
+                    "badRequest"sv, "Bad request"sv, req.version()));
+            }
+            if(!detail::EqualsConstantTime(detail::FindBearerToken(req), *metrics_token_)){
+                return send(api_handler_.MakeErrorResponse(http::status::unauthorized, 
+                    "invalidToken"sv, "Metrics token is missing or invalid"sv, req.version()));
+            }
+            std::string body = detail::MakeMetricsBody(metrics_, *load_monitor_, 
+                                                       api_handler_.app_.GetSnapshotCacheStats());
+            return send(api_handler_.MakeResponse(http::status::ok, body, req.version(), body.size(), 
+                "application/json"s));
+        }
+        if(route == detail::ApiRoute::STATE && detail::GET_HEAD_METHODS.IsSame(req.method())){
+            if(auto version = detail::FindUintArg(req.target(), "waitForTick"sv)){
+                return WaitForTick(std::forward<Request>(req), *version, std::forward<Send>(send));
+            }
+        }
+        if(route == detail::ApiRoute::STATE || route == detail::ApiRoute::PLAYERS){
+            try {
+                return std::visit([&send](auto&& response){
+                    send(std::forward<decltype(response)>(response));
+                }, api_handler_.MakeSnapshotResponse(req));
+            } catch (...) {
+                return send(api_handler_.MakeErrorResponse(http::status::bad_request, 
+                    "badRequest"sv, "Bad request"sv, req.version()));
+            }
+        }
+
         /* Api запросы обрабатывает ApiHandler*/
-        if(detail::IsMatched(std::string(req.target()), "(/api/).*")){
+        if(req.target().starts_with("/api/"sv)){
             auto handle = [self = shared_from_this(), send, req] {
+                self->load_monitor_->OnDequeued();
                 try {
                     // Этот assert не выстрелит, так как лямбда-функция будет выполняться внутри strand
                     assert(self->api_handler_.GetStrand().running_in_this_thread());
-                    return send(self->api_handler_.MakeApiResponse(req));
+                    return std::visit([&send](auto&& response){
+                        send(std::forward<decltype(response)>(response));
+                    }, self->api_handler_.MakeApiResponse(req));
                 } catch (...) {
                     send(self->api_handler_.MakeErrorResponse(http::status::bad_request, 
                         "badRequest"sv, "Bad request"sv, req.version()));
                 }
             };
+            load_monitor_->OnEnqueued();
             return net::dispatch(api_handler_.GetStrand(), handle);
         }
 
@@ -528,6 +1090,29 @@ public:
                 file_handler_.MakeFileResponse(std::forward<decltype(req)>(req)));  
     }
 
+    /* 
+        Принимает соединение, запросившее переход на WebSocket.
+        Переход на любой путь, кроме канала игры, отклоняется
+    */
+    void Upgrade(beast::tcp_stream&& stream, http::request<http::string_body>&& req, 
+                    http_server::ConnectionSlot&& slot){
+        const net::ip::address& remote_address = slot.GetAddress();
+        detail::ApiRoute route = detail::FindApiRoute(req.target());
+        if(route != detail::ApiRoute::GAME_SOCKET){
+            return RejectUpgrade(std::move(stream), std::move(slot), api_handler_.MakeErrorResponse(http::status::bad_request, 
+                "badRequest"sv, "Bad request"sv, req.version()));
+        }
+        if(rate_limit_ && !CheckRateLimits(route, req, remote_address)){
+            auto res = api_handler_.MakeErrorResponse(http::status::too_many_requests, 
+                "tooManyRequests"sv, "Request rate limit exceeded"sv, req.version());
+            res.set(http::field::retry_after, "1"sv);
+            metrics_.rate_limited[static_cast<size_t>(route)].fetch_add(1, std::memory_order_relaxed);
+            return RejectUpgrade(std::move(stream), std::move(slot), std::move(res));
+        }
+        std::make_shared<game_socket::GameSocket>(std::move(stream), std::move(slot), 
+                                                  api_handler_.app_, token_sockets_)->Run(std::move(req));
+    }
+
     void SaveState(){
         api_handler_.SaveState();
     }
@@ -536,10 +1121,115 @@ public:
         api_handler_.LoadState();
     }
 
+    void ReservePlayers(size_t players_count){
+        api_handler_.ReservePlayers(players_count);
+    }
+
 private:
+    /*
+        Отвечает на запрос состояния, когда опубликован снимок новее version.
+        Если такого снимка ещё нет, запрос паркуется до следующего тика сессии:
+        все припаркованные запросы сессии получают одно и то же сериализованное тело
+    */
+    template<typename Request, typename Send>
+    void WaitForTick(Request&& req, uint64_t version, Send&& send){
+        std::string_view bearer = detail::FindBearerToken(req);
+        SnapshotPtr snapshot = bearer.size() == detail::TOKEN_SIZE ? api_handler_.app_.FindSnapshotByToken(Token(std::string(bearer))) : nullptr;
+        if(!snapshot || snapshot->version > version){
+            /* Ошибки авторизации и уже вышедший тик обслуживаются обычным чтением снимка */
+            return std::visit([&send](auto&& response){
+                send(std::forward<decltype(response)>(response));
+            }, api_handler_.MakeSnapshotResponse(req));
+        }
+
+        auto park = [self = shared_from_this(), req = std::forward<Request>(req), send = std::forward<Send>(send), 
+                        token = Token(std::string(bearer)), version]{
+            self->load_monitor_->OnDequeued();
+            auto respond = [self, req, send](const SnapshotPtr& snapshot){
+                std::visit([&send](auto&& response){
+                    send(std::forward<decltype(response)>(response));
+                }, self->api_handler_.MakeGameStateResponse(req, snapshot));
+            };
+            app::Application& app = self->api_handler_.app_;
+            /* Снимок мог выйти, пока запрос шёл в strand */
+            SnapshotPtr current = app.FindSnapshotByToken(token);
+            if(!current || current->version > version){
+                return current ? respond(current) : send(self->api_handler_.MakeErrorResponse(http::status::unauthorized, 
+                    "unknownToken"sv, "Player token has not been found"sv, req.version()));
+            }
+            auto waiter = std::make_shared<detail::TickWaiter>(self->api_handler_.GetStrand(), std::move(respond));
+            app.SubscribeToSnapshots(token, waiter);
+            waiter->Start(std::move(current));
+        };
+        /* Ожидание тика стоит в очереди strand наравне с остальными запросами API и учитывается в её глубине */
+        load_monitor_->OnEnqueued();
+        net::dispatch(api_handler_.GetStrand(), std::move(park));
+    }
+
+    /* Проверяет лимиты маршрута по токену игрока и по адресу клиента */
+    template<typename Request>
+    bool CheckRateLimits(detail::ApiRoute route, const Request& req, const net::ip::address& remote_address){
+        const detail::RouteLimits& limits = route_limits_[static_cast<size_t>(route)];
+        const auto route_index = static_cast<uint32_t>(route);
+        /* 
+            Ведро по токену заводится только для токена игрока: иначе случайные токены
+            вытесняли бы из таблицы вёдра настоящих игроков. Остальные запросы ограничивает ведро адреса
+        */
+        if(limits.per_token.rate != 0){
+            if(std::string_view token = detail::FindBearerToken(req); token.size() == detail::TOKEN_SIZE
+                && api_handler_.app_.IsKnownToken(Token(std::string(token)))
+                && !rate_limiter_.TryAcquire(rate_limiter::MakeKey(token, route_index), limits.per_token)){
+                return false;
+            }
+        }
+        if(limits.per_ip.rate != 0){
+            // Адреса IPv4 приводятся к виду IPv4-mapped, чтобы ключ строился по одним и тем же 16 байтам
+            auto bytes = (remote_address.is_v4() ? net::ip::make_address_v6(net::ip::v4_mapped, remote_address.to_v4())
+                                                 : remote_address.to_v6()).to_bytes();
+            std::string_view address(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            if(!rate_limiter_.TryAcquire(rate_limiter::MakeKey(address, route_index), limits.per_ip)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Отвечает на отклонённый переход и закрывает соединение. Место в лимитах занято до конца записи */
+    static void RejectUpgrade(beast::tcp_stream&& stream, http_server::ConnectionSlot&& slot, StringResponse&& res){
+        struct Rejected{
+            beast::tcp_stream stream;
+            http_server::ConnectionSlot slot;
+            StringResponse res;
+        };
+        res.keep_alive(false);
+        auto rejected = std::make_shared<Rejected>(Rejected{std::move(stream), std::move(slot), std::move(res)});
+        http::async_write(rejected->stream, rejected->res, [rejected](beast::error_code ec, std::size_t){
+            rejected->stream.socket().shutdown(net::ip::tcp::socket::shutdown_send, ec);
+        });
+    }
+
+    static admission::Limits MakeLimits(const cmd_parser::Args& args){
+        admission::Limits limits;
+        if(args.max_loop_lag){
+            limits.max_loop_lag = admission::Milliseconds(*args.max_loop_lag);
+        }
+        limits.max_queue_depth = args.max_api_queue;
+        limits.retry_after = std::chrono::seconds(args.retry_after);
+        return limits;
+    }
+
     model::Game& game_;
     ApiHandler api_handler_;
     FileHandler file_handler_;
+    std::shared_ptr<admission::LoadMonitor> load_monitor_;
+    bool rate_limit_;
+    std::optional<std::string> metrics_token_;
+    std::array<detail::RouteLimits, detail::API_ROUTES_COUNT> route_limits_;
+    rate_limiter::RateLimiter rate_limiter_;
+    detail::ApiMetrics metrics_;
+    // Сокеты живут дольше обработчика запросов, поэтому счётчик разделяется с ними
+    std::shared_ptr<game_socket::TokenSockets> token_sockets_{
+        std::make_shared<game_socket::TokenSockets>(game_socket::GameSocket::MAX_SOCKETS_PER_TOKEN)};
 };
 
 }  // namespace request_handler
@@ -0,0 +1,469 @@
+#pragma once
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace sendfile_body {
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+/* ------------------------ Part ----------------------------------- */
+
+/*
+    Часть тела ответа: произвольный префикс (например, заголовок части multipart/byteranges)
+    и следующий за ним диапазон [offset, offset + length) исходного содержимого
+*/
+struct Part{
+    std::string prefix;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+inline uint64_t PartsSize(const std::vector<Part>& parts){
+    return std::accumulate(parts.begin(), parts.end(), uint64_t{0}, [](uint64_t sum, const Part& part){
+        return sum + part.prefix.size() + part.length;
+    });
+}
+
+/* ------------------------ SendfileBody ----------------------------------- */
+
+/*
+    Тело HTTP-ответа, содержащее открытый файл и список отправляемых частей.
+    По умолчанию часть одна - весь файл, для ответов 206 частей может быть несколько.
+    Сессия отправляет диапазоны файла системным вызовом sendfile прямо из кэша страниц в сокет.
+    Если sendfile недоступен, файл читается кусками с помощью pread
+*/
+struct SendfileBody{
+    class value_type{
+    public:
+        value_type() = default;
+
+        value_type(const value_type&) = delete;
+        value_type& operator=(const value_type&) = delete;
+
+        value_type(value_type&& other) noexcept
+            : fd_(std::exchange(other.fd_, -1))
+            , file_size_(std::exchange(other.file_size_, 0))
+            , parts_(std::move(other.parts_)){
+        }
+
+        value_type& operator=(value_type&& other) noexcept{
+            if(this != &other){
+                Close();
+                fd_ = std::exchange(other.fd_, -1);
+                file_size_ = std::exchange(other.file_size_, 0);
+                parts_ = std::move(other.parts_);
+            }
+            return *this;
+        }
+
+        ~value_type(){
+            Close();
+        }
+
+        void Open(const char* path, beast::error_code& ec){
+            Close();
+            fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+            struct stat file_stat;
+            if(fd_ < 0 || ::fstat(fd_, &file_stat) != 0){
+                ec.assign(errno, beast::system_category());
+                Close();
+                return;
+            }
+            file_size_ = static_cast<uint64_t>(file_stat.st_size);
+            parts_ = {Part{{}, 0, file_size_}};
+            ec = {};
+        }
+
+        /* Заменяет отправляемые части, диапазоны должны лежать в пределах файла */
+        void SetParts(std::vector<Part> parts){
+            parts_ = std::move(parts);
+        }
+
+        bool IsOpen() const noexcept{
+            return fd_ >= 0;
+        }
+
+        int GetFd() const noexcept{
+            return fd_;
+        }
+
+        uint64_t GetFileSize() const noexcept{
+            return file_size_;
+        }
+
+        const std::vector<Part>& GetParts() const noexcept{
+            return parts_;
+        }
+
+        /* Размер тела ответа */
+        uint64_t GetSize() const noexcept{
+            return PartsSize(parts_);
+        }
+    private:
+        void Close() noexcept{
+            if(fd_ >= 0){
+                ::close(fd_);
+                fd_ = -1;
+            }
+            file_size_ = 0;
+            parts_.clear();
+        }
+
+        int fd_ = -1;
+        uint64_t file_size_ = 0;
+        std::vector<Part> parts_;
+    };
+
+    static uint64_t size(const value_type& body){
+        return body.GetSize();
+    }
+
+    /* Запасной путь: чтение файла кусками в буфер */
+    class writer{
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(const http::header<isRequest, Fields>&, const value_type& body)
+            : body_(body){
+        }
+
+        void init(beast::error_code& ec){
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>> get(beast::error_code& ec){
+            ec = {};
+            const auto& parts = body_.GetParts();
+            while(part_ < parts.size()){
+                const Part& part = parts[part_];
+                if(!prefix_sent_){
+                    prefix_sent_ = true;
+                    if(!part.prefix.empty()){
+                        return std::make_pair(const_buffers_type(part.prefix.data(), part.prefix.size()), true);
+                    }
+                }
+                if(position_ < part.length){
+                    break;
+                }
+                ++part_;
+                prefix_sent_ = false;
+                position_ = 0;
+            }
+            if(part_ == parts.size()){
+                return boost::none;
+            }
+
+            const Part& part = parts[part_];
+            size_t amount = static_cast<size_t>(std::min<uint64_t>(buffer_.size(), part.length - position_));
+            ssize_t bytes_read = ::pread(body_.GetFd(), buffer_.data(), amount,
+                                         static_cast<off_t>(part.offset + position_));
+            if(bytes_read <= 0){
+                ec = bytes_read < 0
+                    ? beast::error_code(errno, beast::system_category())
+                    : beast::error_code(http::error::short_read);
+                return boost::none;
+            }
+
+            position_ += bytes_read;
+            bool more = position_ < part.length || part_ + 1 < parts.size();
+            return std::make_pair(const_buffers_type(buffer_.data(), bytes_read), more);
+        }
+    private:
+        const value_type& body_;
+        size_t part_ = 0;
+        bool prefix_sent_ = false;
+        uint64_t position_ = 0;
+        std::array<char, 64 * 1024> buffer_;
+    };
+};
+
+namespace detail {
+
+template<typename Socket, typename Handler>
+struct SendFileState{
+    Socket& socket;
+    int fd;
+    off_t offset;
+    uint64_t remaining;
+    size_t sent = 0;
+    Handler handler;
+};
+
+template<typename Socket, typename Handler>
+void SendFileStep(std::shared_ptr<SendFileState<Socket, Handler>> state){
+#ifdef __linux__
+    while(state->remaining > 0){
+        ssize_t bytes_sent = ::sendfile(state->socket.native_handle(), state->fd, &state->offset,
+                                        static_cast<size_t>(state->remaining));
+        if(bytes_sent > 0){
+            /* Частичная запись: ядро уже сдвинуло offset, продолжаем с остатка */
+            state->remaining -= bytes_sent;
+            state->sent += bytes_sent;
+            continue;
+        }
+
+        if(bytes_sent < 0 && errno == EINTR){
+            continue;
+        }
+
+        if(bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            /* Буфер сокета заполнен - ждём готовности к записи, не блокируя поток */
+            auto& socket = state->socket;
+            socket.async_wait(net::socket_base::wait_write, [state](beast::error_code ec){
+                if(ec){
+                    return state->handler(ec, state->sent);
+                }
+                SendFileStep(std::move(state));
+            });
+            return;
+        }
+
+        /* sendfile не умеет работать с этим файлом: вызывающий отправит его обычным путём */
+        if(bytes_sent < 0 && state->sent == 0 && (errno == EINVAL || errno == ENOSYS)){
+            return state->handler(beast::error_code(net::error::operation_not_supported), 0);
+        }
+
+        beast::error_code ec = bytes_sent < 0
+            ? beast::error_code(errno, beast::system_category())
+            : beast::error_code(http::error::short_read);
+        return state->handler(ec, state->sent);
+    }
+
+    state->handler(beast::error_code{}, state->sent);
+#else
+    state->handler(beast::error_code(net::error::operation_not_supported), 0);
+#endif
+}
+
+} // namespace detail
+
+/*
+    Асинхронно отправляет size байт файла fd, начиная с offset, в сокет через sendfile.
+    handler(error_code, bytes_sent) вызывается ровно один раз и никогда внутри самой AsyncSendFile.
+    Ошибка operation_not_supported означает, что ничего не отправлено
+    и файл нужно отправить обычным путём
+*/
+template<typename Socket, typename Handler>
+void AsyncSendFile(Socket& socket, int fd, uint64_t offset, uint64_t size, Handler&& handler){
+    using State = detail::SendFileState<Socket, std::decay_t<Handler>>;
+    auto state = std::make_shared<State>(State{socket, fd, static_cast<off_t>(offset), size, 0,
+                                                std::forward<Handler>(handler)});
+
+    beast::error_code ec;
+    socket.native_non_blocking(true, ec);
+    if(ec){
+        net::post(socket.get_executor(), [state, ec]{
+            state->handler(ec, 0);
+        });
+        return;
+    }
+
+    /* Первая попытка тоже начинается с ожидания, чтобы handler не вызывался синхронно */
+    socket.async_wait(net::socket_base::wait_write, [state](beast::error_code ec){
+        if(ec){
+            return state->handler(ec, 0);
+        }
+        detail::SendFileStep(std::move(state));
+    });
+}
+
+namespace detail {
+
+/* 
+    Срок отправки тела. Операции идут прямо по сокету, мимо таймера beast::tcp_stream,
+    поэтому клиента, который перестал читать, отключает этот таймер.
+    Лежит в обычной куче: отменённое ожидание может пережить и состояние отправки, и сессию
+*/
+template<typename Socket>
+struct WriteDeadline{
+    WriteDeadline(Socket& socket, std::chrono::steady_clock::duration timeout)
+        : timer(socket.get_executor(), timeout)
+        , socket(socket) {
+    }
+
+    net::steady_timer timer;
+    Socket& socket;
+    bool expired = false;
+    bool finished = false;
+};
+
+template<typename Socket>
+void StartDeadline(const std::shared_ptr<WriteDeadline<Socket>>& deadline){
+    deadline->timer.async_wait([deadline](beast::error_code ec){
+        /* Отправка могла завершиться, пока ожидание стояло в очереди: сокета тогда может уже не быть */
+        if(ec || deadline->finished){
+            return;
+        }
+        deadline->expired = true;
+        beast::error_code ignored;
+        deadline->socket.cancel(ignored);
+    });
+}
+
+template<typename Socket, typename Handler>
+struct SendBodyState{
+    Socket& socket;
+    const SendfileBody::value_type& body;
+    std::shared_ptr<WriteDeadline<Socket>> deadline;
+    Handler handler;
+    size_t part = 0;
+    bool prefix_sent = false;
+    bool use_sendfile = true;
+    uint64_t position = 0;
+    size_t sent = 0;
+    std::vector<char> buffer;
+};
+
+template<typename Socket, typename Handler>
+void SendBodyStep(std::shared_ptr<SendBodyState<Socket, Handler>> state);
+
+/* 
+    Завершает отправку тела. Состояние освобождается до вызова обработчика:
+    оно может лежать в памяти сессии, которую обработчик уничтожит
+*/
+template<typename Socket, typename Handler>
+void CompleteSendBody(std::shared_ptr<SendBodyState<Socket, Handler>>&& state, beast::error_code ec){
+    state->deadline->finished = true;
+    state->deadline->timer.cancel();
+    if(ec && state->deadline->expired){
+        ec = beast::error::timeout;
+    }
+
+    Handler handler = std::move(state->handler);
+    size_t sent = state->sent;
+    state.reset();
+    handler(ec, sent);
+}
+
+/* Запасной путь для части, если sendfile недоступен: pread в буфер и обычная запись */
+template<typename Socket, typename Handler>
+void SendPartByCopy(std::shared_ptr<SendBodyState<Socket, Handler>> state){
+    const Part& part = state->body.GetParts()[state->part];
+    state->buffer.resize(64 * 1024);
+    size_t amount = static_cast<size_t>(std::min<uint64_t>(state->buffer.size(), part.length - state->position));
+    ssize_t bytes_read = ::pread(state->body.GetFd(), state->buffer.data(), amount,
+                                 static_cast<off_t>(part.offset + state->position));
+    if(bytes_read <= 0){
+        beast::error_code ec = bytes_read < 0
+            ? beast::error_code(errno, beast::system_category())
+            : beast::error_code(http::error::short_read);
+        auto& socket = state->socket;
+        return net::post(socket.get_executor(), [state = std::move(state), ec]() mutable {
+            CompleteSendBody(std::move(state), ec);
+        });
+    }
+
+    auto& socket = state->socket;
+    auto buffer = net::buffer(state->buffer.data(), bytes_read);
+    net::async_write(socket, buffer, [state = std::move(state)](beast::error_code ec, size_t bytes_written) mutable {
+        state->sent += bytes_written;
+        state->position += bytes_written;
+        if(ec){
+            return CompleteSendBody(std::move(state), ec);
+        }
+        SendBodyStep(std::move(state));
+    });
+}
+
+template<typename Socket, typename Handler>
+void SendBodyStep(std::shared_ptr<SendBodyState<Socket, Handler>> state){
+    const auto& parts = state->body.GetParts();
+    while(state->part < parts.size()){
+        const Part& part = parts[state->part];
+        auto& socket = state->socket;
+
+        if(!state->prefix_sent){
+            state->prefix_sent = true;
+            if(!part.prefix.empty()){
+                net::async_write(socket, net::buffer(part.prefix), [state = std::move(state)](beast::error_code ec, size_t bytes_written) mutable {
+                    state->sent += bytes_written;
+                    if(ec){
+                        return CompleteSendBody(std::move(state), ec);
+                    }
+                    SendBodyStep(std::move(state));
+                });
+                return;
+            }
+        }
+
+        if(state->position < part.length){
+            if(!state->use_sendfile){
+                return SendPartByCopy(std::move(state));
+            }
+            int fd = state->body.GetFd();
+            uint64_t offset = part.offset + state->position;
+            uint64_t size = part.length - state->position;
+            AsyncSendFile(socket, fd, offset, size, [state = std::move(state)](beast::error_code ec, size_t bytes_sent) mutable {
+                state->sent += bytes_sent;
+                state->position += bytes_sent;
+                if(ec == net::error::operation_not_supported){
+                    state->use_sendfile = false;
+                } else if(ec){
+                    return CompleteSendBody(std::move(state), ec);
+                }
+                SendBodyStep(std::move(state));
+            });
+            return;
+        }
+
+        ++state->part;
+        state->prefix_sent = false;
+        state->position = 0;
+    }
+
+    CompleteSendBody(std::move(state), beast::error_code{});
+}
+
+} // namespace detail
+
+/*
+    Асинхронно отправляет все части тела: префиксы обычной записью, диапазоны файла через sendfile.
+    Если sendfile недоступен, оставшиеся диапазоны отправляются через буфер.
+    Если тело не отправлено за timeout, запись прерывается с ошибкой beast::error::timeout.
+    body должно жить до вызова handler(error_code, bytes_sent)
+*/
+template<typename Socket, typename Handler>
+void AsyncSendBody(Socket& socket, const SendfileBody::value_type& body, 
+                   std::chrono::steady_clock::duration timeout, Handler&& handler){
+    using State = detail::SendBodyState<Socket, std::decay_t<Handler>>;
+    // Состояние размещается распределителем обработчика: у сопрограммной сессии это её переиспользуемая память.
+    // Поэтому на состояние всегда ссылается ровно один владелец, и оно освобождается до вызова handler
+    auto allocator = net::get_associated_allocator(handler);
+    auto deadline = std::make_shared<detail::WriteDeadline<Socket>>(socket, timeout);
+    detail::StartDeadline(deadline);
+    auto state = std::allocate_shared<State>(allocator, State{socket, body, std::move(deadline), 
+                                                               std::forward<Handler>(handler)});
+    net::post(socket.get_executor(), [state = std::move(state)]() mutable {
+        detail::SendBodyStep(std::move(state));
+    });
+}
+
+}  // namespace sendfile_body
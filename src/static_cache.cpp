@@ -0,0 +1,521 @@
+#include "static_cache.h"
+#include "etag.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <fstream>
+#include <iterator>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace static_cache {
+
+using namespace std::literals;
+
+namespace {
+
+const std::unordered_map<std::string_view, std::string_view> FILES_EXTENSIONS {
+        {".htm", "text/html"}, {".html", "text/html"}, {".css", "text/css"},
+        {".txt", "text/plain"}, {".js", "text/javascript"}, {".json", "application/json"},
+        {".xml", "application/xml"}, {".png", "image/png"}, {".jpg", "image/jpeg"},
+        {".jpe", "image/jpeg"}, {".jpeg", "image/jpeg"},  {".gif", "image/gif"},
+        {".bmp", "image/bmp"}, {".ico", "image/vnd.microsoft.icon"}, {".tiff", "image/tiff"},
+        {".tif", "image/tiff"},  {".svg", "image/svg+xml"},  {".svgz", "image/svg+xml"},
+        {".mp3", "audio/mpeg"}
+};
+
+std::string_view Trim(std::string_view str){
+    while(!str.empty() && (str.front() == ' ' || str.front() == '\t')){
+        str.remove_prefix(1);
+    }
+    while(!str.empty() && (str.back() == ' ' || str.back() == '\t')){
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs){
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char a, char b){
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+/* Вызывает action для каждого элемента списка, разделённого запятыми */
+template<typename Fn>
+void ForEachListItem(std::string_view list, Fn&& action){
+    while(!list.empty()){
+        size_t comma = list.find(',');
+        action(Trim(list.substr(0, comma)));
+        if(comma == list.npos){
+            break;
+        }
+        list.remove_prefix(comma + 1);
+    }
+}
+
+bool IsCompressible(std::string_view content_type){
+    return content_type.starts_with("text/"sv)
+        || content_type == "application/json"sv
+        || content_type == "application/xml"sv
+        || content_type == "image/svg+xml"sv;
+}
+
+std::optional<uint64_t> ParseNumber(std::string_view str){
+    uint64_t value = 0;
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    if(str.empty() || ec != std::errc{} || ptr != str.data() + str.size()){
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::string ReadFile(const fs::path& path){
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+        throw std::runtime_error("Failed to open "s + path.string());
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+Asset MakeAsset(const fs::path& path, std::string data, uintmax_t file_size, fs::file_time_type modified){
+    Asset asset;
+    asset.content_type = FindContentType(path.filename().string());
+    asset.content_hash = etag::HashContent(data);
+    asset.etag = etag::MakeEtag(data, asset.content_hash);
+    asset.file_size = file_size;
+    asset.modified = modified;
+    asset.path = path;
+
+    /* Сжатый вариант хранится, только если он заметно меньше исходного */
+    if(data.size() >= StaticCache::MIN_GZIP_SIZE && IsCompressible(asset.content_type)){
+        std::string compressed = compression::CompressIfSmaller(data, compression::Coding::GZIP, compression::BEST_LEVEL);
+        if(!compressed.empty()){
+            asset.gzip_data = std::make_shared<const std::string>(std::move(compressed));
+        }
+    }
+    if(asset.gzip_data || data.size() < StaticCache::MIN_SENDFILE_SIZE){
+        asset.data = std::make_shared<const std::string>(std::move(data));
+    }
+    return asset;
+}
+
+bool IsHtml(std::string_view content_type){
+    return content_type == "text/html"sv;
+}
+
+/*
+    Ключ манифеста, на который ссылается атрибут src/href HTML-страницы с ключом page,
+    или пустая строка для внешних ссылок
+*/
+std::string ResolveReference(std::string_view page, std::string_view reference){
+    if(reference.empty() || reference.starts_with("//"sv) || reference.find(':') != reference.npos){
+        return {};
+    }
+    if(reference.starts_with('/')){
+        return fs::path(reference.substr(1)).lexically_normal().generic_string();
+    }
+    return (fs::path(page).parent_path() / reference).lexically_normal().generic_string();
+}
+
+/*
+    Заменяет в HTML ссылки src="..." и href="..." на файлы манифеста
+    их версиями с хешем содержимого в имени
+*/
+std::string RewriteReferences(const std::string& html, std::string_view page, const StaticCache::Manifest& manifest){
+    std::string result;
+    result.reserve(html.size());
+    size_t position = 0;
+
+    while(position < html.size()){
+        size_t attribute = html.find_first_of("sShH"sv, position);
+        if(attribute == html.npos){
+            break;
+        }
+
+        std::string_view rest = std::string_view(html).substr(attribute);
+        size_t name_size = 0;
+        if(attribute > 0 && std::isspace(static_cast<unsigned char>(html[attribute - 1]))){
+            if(rest.size() > 4 && EqualsIgnoreCase(rest.substr(0, 4), "src="sv)){
+                name_size = 4;
+            } else if(rest.size() > 5 && EqualsIgnoreCase(rest.substr(0, 5), "href="sv)){
+                name_size = 5;
+            }
+        }
+        char quote = name_size > 0 ? rest[name_size] : '\0';
+        size_t value_begin = attribute + name_size + 1;
+        size_t value_end = quote == '"' || quote == '\'' ? html.find(quote, value_begin) : html.npos;
+        if(value_end == html.npos){
+            result.append(html, position, attribute + 1 - position);
+            position = attribute + 1;
+            continue;
+        }
+
+        std::string_view value = std::string_view(html).substr(value_begin, value_end - value_begin);
+        std::string_view reference = value.substr(0, value.find_first_of("?#"sv));
+        auto it = manifest.find(ResolveReference(page, reference));
+
+        result.append(html, position, value_begin - position);
+        if(it != manifest.end() && !it->second.fingerprinted_path.empty()){
+            /* Заменяется только имя файла: относительная ссылка остаётся относительной */
+            size_t slash = reference.find_last_of('/');
+            std::string_view file_name = std::string_view(it->second.fingerprinted_path);
+            file_name.remove_prefix(file_name.find_last_of('/') + 1);
+            result.append(reference.substr(0, slash == reference.npos ? 0 : slash + 1))
+                  .append(file_name)
+                  .append(value.substr(reference.size()));
+        } else {
+            result.append(value);
+        }
+        position = value_end;
+    }
+
+    result.append(html, position, html.npos);
+    return result;
+}
+
+} // namespace
+
+std::string MakeFingerprintedPath(std::string_view path, uint64_t hash){
+    /* Хеш дополняется нулями слева до 16 цифр */
+    std::array<char, 16> digits;
+    digits.fill('0');
+    std::array<char, 16> buffer;
+    auto end = std::to_chars(buffer.data(), buffer.data() + buffer.size(), hash, 16).ptr;
+    std::copy(buffer.data(), end, digits.end() - (end - buffer.data()));
+    std::string_view fingerprint(digits.data(), digits.size());
+
+    size_t slash = path.find_last_of('/');
+    size_t point = path.find_last_of('.');
+    /* Точка в начале имени (.htaccess) не отделяет расширение */
+    if(point == path.npos || (slash != path.npos && point <= slash + 1) || point == 0){
+        point = path.size();
+    }
+
+    std::string result;
+    result.reserve(path.size() + fingerprint.size() + 1);
+    result.append(path.substr(0, point)).append("."sv).append(fingerprint).append(path.substr(point));
+    return result;
+}
+
+std::string FindContentType(std::string_view path){
+    auto point = path.find_last_of('.');
+    if(point != path.npos){
+        std::string extension(path.substr(point));
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){
+            return std::tolower(c);
+        });
+        if(auto it = FILES_EXTENSIONS.find(extension); it != FILES_EXTENSIONS.end()){
+            return std::string(it->second);
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool MatchesEtag(std::string_view if_none_match, std::string_view etag){
+    bool matches = false;
+    ForEachListItem(if_none_match, [&matches, etag](std::string_view item){
+        /* Для If-None-Match допускается слабое сравнение */
+        if(item.starts_with("W/"sv)){
+            item.remove_prefix(2);
+        }
+        matches = matches || item == "*"sv || item == etag;
+    });
+    return matches;
+}
+
+bool AcceptsCoding(std::string_view accept_encoding, compression::Coding requested){
+    const std::string_view name = compression::GetName(requested);
+    /* 
+        Явно названное кодирование важнее «*» независимо от порядка (RFC 9110, 12.5.3):
+        «*» решает, только если кодирование не названо
+    */
+    std::optional<bool> named;
+    std::optional<bool> wildcard;
+    ForEachListItem(accept_encoding, [&named, &wildcard, name](std::string_view item){
+        std::string_view coding = Trim(item.substr(0, item.find(';')));
+        /* gzip;q=0 означает явный отказ */
+        bool accepts = true;
+        if(size_t q = item.find("q="sv); q != item.npos){
+            std::string_view weight = Trim(item.substr(q + 2));
+            accepts = !weight.empty() && weight.find_first_not_of("0."sv) != weight.npos;
+        }
+        if(EqualsIgnoreCase(coding, name)){
+            named = accepts;
+        } else if(coding == "*"sv){
+            wildcard = accepts;
+        }
+    });
+    return named.value_or(wildcard.value_or(false));
+}
+
+bool AcceptsGzip(std::string_view accept_encoding){
+    return AcceptsCoding(accept_encoding, compression::Coding::GZIP);
+}
+
+compression::Coding SelectCoding(std::string_view accept_encoding){
+    if(AcceptsCoding(accept_encoding, compression::Coding::GZIP)){
+        return compression::Coding::GZIP;
+    }
+    if(AcceptsCoding(accept_encoding, compression::Coding::DEFLATE)){
+        return compression::Coding::DEFLATE;
+    }
+    return compression::Coding::IDENTITY;
+}
+
+std::optional<std::vector<ByteRange>> ParseRange(std::string_view range, uint64_t size){
+    constexpr std::string_view unit = "bytes="sv;
+    range = Trim(range);
+    if(range.size() < unit.size() || !EqualsIgnoreCase(range.substr(0, unit.size()), unit)){
+        return std::nullopt;
+    }
+    range.remove_prefix(unit.size());
+
+    std::vector<ByteRange> ranges;
+    bool valid = true;
+    size_t specs_count = 0;
+    ForEachListItem(range, [&](std::string_view spec){
+        if(spec.empty()){
+            return;
+        }
+        ++specs_count;
+        size_t dash = spec.find('-');
+        if(dash == spec.npos){
+            valid = false;
+            return;
+        }
+
+        std::string_view first_str = Trim(spec.substr(0, dash));
+        std::string_view last_str = Trim(spec.substr(dash + 1));
+        if(first_str.empty()){
+            /* Суффикс: последние N байт */
+            std::optional<uint64_t> suffix = ParseNumber(last_str);
+            if(!suffix){
+                valid = false;
+            } else if(*suffix > 0 && size > 0){
+                ranges.push_back({size - std::min(*suffix, size), size - 1});
+            }
+            return;
+        }
+
+        std::optional<uint64_t> first = ParseNumber(first_str);
+        std::optional<uint64_t> last = last_str.empty() ? std::optional<uint64_t>(UINT64_MAX) : ParseNumber(last_str);
+        if(!first || !last || *first > *last){
+            valid = false;
+        } else if(*first < size){
+            ranges.push_back({*first, std::min(*last, size - 1)});
+        }
+    });
+
+    if(!valid || specs_count == 0 || specs_count > MAX_RANGES_COUNT){
+        return std::nullopt;
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange& lhs, const ByteRange& rhs){
+        return lhs.first < rhs.first;
+    });
+    std::vector<ByteRange> merged;
+    for(const ByteRange& current : ranges){
+        if(!merged.empty() && current.first <= merged.back().last + 1){
+            merged.back().last = std::max(merged.back().last, current.last);
+        } else {
+            merged.push_back(current);
+        }
+    }
+    return merged;
+}
+
+bool IfRangeMatches(std::string_view if_range, std::string_view etag){
+    /* Для If-Range допускается только сильное сравнение, даты не поддерживаются: Last-Modified не отдаётся */
+    if_range = Trim(if_range);
+    return !etag.empty() && !if_range.starts_with("W/"sv) && if_range == etag;
+}
+
+std::string MakeContentRange(const ByteRange& range, uint64_t size){
+    return "bytes "s + std::to_string(range.first) + "-"s + std::to_string(range.last) + "/"s + std::to_string(size);
+}
+
+std::vector<sendfile_body::Part> MakeRangeParts(const std::vector<ByteRange>& ranges,
+                                                std::string_view content_type, uint64_t size){
+    std::vector<sendfile_body::Part> parts;
+    if(ranges.size() == 1){
+        parts.push_back({{}, ranges.front().first, ranges.front().Length()});
+        return parts;
+    }
+
+    parts.reserve(ranges.size() + 1);
+    for(const ByteRange& range : ranges){
+        std::string prefix;
+        prefix.append(parts.empty() ? "--"sv : "\r\n--"sv).append(BYTERANGES_BOUNDARY)
+              .append("\r\nContent-Type: "sv).append(content_type)
+              .append("\r\nContent-Range: "sv).append(MakeContentRange(range, size))
+              .append("\r\n\r\n"sv);
+        parts.push_back({std::move(prefix), range.first, range.Length()});
+    }
+
+    std::string epilogue;
+    epilogue.append("\r\n--"sv).append(BYTERANGES_BOUNDARY).append("--\r\n"sv);
+    parts.push_back({std::move(epilogue), 0, 0});
+    return parts;
+}
+
+/* ------------------------ StaticCache ----------------------------------- */
+
+StaticCache::StaticCache(fs::path root)
+    : root_(fs::canonical(root)), manifest_(std::make_shared<const Manifest>()){
+    Rebuild();
+}
+
+StaticCache::~StaticCache(){
+    if(watcher_.joinable()){
+        watcher_.request_stop();
+        watcher_.join();
+    }
+#ifdef __linux__
+    if(inotify_fd_ >= 0){
+        close(inotify_fd_);
+    }
+#endif
+}
+
+StaticCache::ManifestPtr StaticCache::GetManifest() const{
+    return std::atomic_load(&manifest_);
+}
+
+void StaticCache::Rebuild(){
+    std::lock_guard lock(rebuild_mutex_);
+    ManifestPtr previous = GetManifest();
+    auto manifest = std::make_shared<Manifest>();
+    /* HTML обрабатывается последним: ссылки в нём заменяются на пути с хешами остальных файлов */
+    std::vector<fs::directory_entry> pages;
+
+    for(const auto& entry : fs::recursive_directory_iterator(root_, fs::directory_options::skip_permission_denied)){
+        if(!entry.is_regular_file()){
+            continue;
+        }
+
+        uintmax_t file_size = entry.file_size();
+        if(file_size > MAX_CACHED_FILE_SIZE){
+            continue;
+        }
+
+        if(IsHtml(FindContentType(entry.path().filename().string()))){
+            pages.push_back(entry);
+            continue;
+        }
+
+        fs::file_time_type modified = entry.last_write_time();
+        std::string key = fs::relative(entry.path(), root_).generic_string();
+        if(auto it = previous->find(key); it != previous->end()
+                && it->second.file_size == file_size && it->second.modified == modified){
+            manifest->emplace(std::move(key), it->second);
+            continue;
+        }
+
+        try{
+            Asset asset = MakeAsset(entry.path(), ReadFile(entry.path()), file_size, modified);
+            asset.fingerprinted_path = MakeFingerprintedPath(key, asset.content_hash);
+            manifest->emplace(std::move(key), std::move(asset));
+        } catch(const std::exception& ex){
+            /* Файл, который не удалось прочитать, будет отдаваться с диска */
+            LOG_ERROR(0, ex.what(), "static cache"s);
+        }
+    }
+
+    /* Страницы пересобираются всегда: могли измениться хеши файлов, на которые они ссылаются */
+    for(const auto& entry : pages){
+        std::string key = fs::relative(entry.path(), root_).generic_string();
+        try{
+            std::string html = RewriteReferences(ReadFile(entry.path()), key, *manifest);
+            manifest->emplace(std::move(key), MakeAsset(entry.path(), std::move(html), 
+                                                        entry.file_size(), entry.last_write_time()));
+        } catch(const std::exception& ex){
+            LOG_ERROR(0, ex.what(), "static cache"s);
+        }
+    }
+
+    /* Псевдонимы с хешем в имени отдаются как неизменяемые */
+    std::vector<std::pair<std::string, Asset>> aliases;
+    for(const auto& [key, asset] : *manifest){
+        if(!asset.fingerprinted_path.empty()){
+            Asset alias = asset;
+            alias.immutable = true;
+            aliases.emplace_back(asset.fingerprinted_path, std::move(alias));
+        }
+    }
+    for(auto& [path, alias] : aliases){
+        manifest->emplace(std::move(path), std::move(alias));
+    }
+
+    std::atomic_store(&manifest_, ManifestPtr(std::move(manifest)));
+}
+
+void StaticCache::StartWatching(){
+#ifdef __linux__
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd_ < 0){
+        LOG_ERROR(errno, "inotify_init1 failed"s, "static cache"s);
+        return;
+    }
+    AddWatches();
+    watcher_ = std::jthread([this](std::stop_token stop){
+        Watch(stop);
+    });
+#endif
+}
+
+void StaticCache::AddWatches(){
+#ifdef __linux__
+    constexpr uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    /* Повторное добавление уже наблюдаемого каталога ничего не меняет */
+    inotify_add_watch(inotify_fd_, root_.c_str(), mask);
+    for(const auto& entry : fs::recursive_directory_iterator(root_, fs::directory_options::skip_permission_denied)){
+        if(entry.is_directory()){
+            inotify_add_watch(inotify_fd_, entry.path().c_str(), mask);
+        }
+    }
+#endif
+}
+
+void StaticCache::Watch(std::stop_token stop){
+#ifdef __linux__
+    constexpr int POLL_TIMEOUT_MS = 500;
+    /* Изменения, пришедшие пачкой (например, при деплое), применяются одной пересборкой */
+    constexpr int DEBOUNCE_MS = 100;
+    alignas(inotify_event) std::array<char, 4096> buffer;
+
+    auto drain = [this, &buffer]{
+        bool has_events = false;
+        while(read(inotify_fd_, buffer.data(), buffer.size()) > 0){
+            has_events = true;
+        }
+        return has_events;
+    };
+
+    while(!stop.stop_requested()){
+        pollfd fd{inotify_fd_, POLLIN, 0};
+        if(poll(&fd, 1, POLL_TIMEOUT_MS) <= 0 || !drain()){
+            continue;
+        }
+
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(DEBOUNCE_MS));
+        } while(drain() && !stop.stop_requested());
+
+        try{
+            AddWatches();
+            Rebuild();
+        } catch(const std::exception& ex){
+            LOG_ERROR(0, ex.what(), "static cache"s);
+        }
+    }
+#endif
+}
+
+}  // namespace static_cache
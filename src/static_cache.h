@@ -0,0 +1,248 @@
+#pragma once
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "compression.h"
+#include "sendfile_body.h"
+
+namespace static_cache {
+
+namespace fs = std::filesystem;
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+/* MIME-тип файла по его расширению */
+std::string FindContentType(std::string_view path);
+
+/* Содержит ли заголовок If-None-Match указанный ETag */
+bool MatchesEtag(std::string_view if_none_match, std::string_view etag);
+
+/* Допускает ли заголовок Accept-Encoding кодирование coding */
+bool AcceptsCoding(std::string_view accept_encoding, compression::Coding coding);
+
+/* Допускает ли заголовок Accept-Encoding сжатие gzip */
+bool AcceptsGzip(std::string_view accept_encoding);
+
+/* Кодирование ответа по заголовку Accept-Encoding: gzip, затем deflate, иначе без сжатия */
+compression::Coding SelectCoding(std::string_view accept_encoding);
+
+/* Путь с хешем содержимого перед расширением: js/game.js -> js/game.<hash>.js */
+std::string MakeFingerprintedPath(std::string_view path, uint64_t hash);
+
+/* Файлы по путям с хешем не меняются никогда, поэтому кэшируются на год */
+inline constexpr std::string_view IMMUTABLE_CACHE_CONTROL = "public, max-age=31536000, immutable";
+
+/* ------------------------ Ranges ----------------------------------- */
+
+/* Диапазон байт [first, last] включительно */
+struct ByteRange{
+    uint64_t first = 0;
+    uint64_t last = 0;
+
+    uint64_t Length() const noexcept{
+        return last - first + 1;
+    }
+};
+
+/* Ответ 206 с несколькими диапазонами не может содержать больше частей */
+inline constexpr size_t MAX_RANGES_COUNT = 16;
+inline constexpr std::string_view BYTERANGES_BOUNDARY = "4f1c2d7e9a3b8c60";
+
+/*
+    Разбирает заголовок Range для содержимого размера size.
+    Пересекающиеся и смежные диапазоны объединяются.
+    std::nullopt - заголовок нужно проигнорировать и отдать файл целиком,
+    пустой вектор - ни один диапазон не удовлетворим (416)
+*/
+std::optional<std::vector<ByteRange>> ParseRange(std::string_view range, uint64_t size);
+
+/* Разрешает ли заголовок If-Range частичный ответ для представления с указанным ETag */
+bool IfRangeMatches(std::string_view if_range, std::string_view etag);
+
+/* Значение Content-Range для диапазона */
+std::string MakeContentRange(const ByteRange& range, uint64_t size);
+
+/*
+    Части тела ответа 206. Для одного диапазона префикс пуст,
+    для нескольких - заголовки частей multipart/byteranges, последняя часть содержит завершающую границу
+*/
+std::vector<sendfile_body::Part> MakeRangeParts(const std::vector<ByteRange>& ranges,
+                                                std::string_view content_type, uint64_t size);
+
+/* ------------------------ SharedBufferBody ----------------------------------- */
+
+/*
+    Тело HTTP-ответа, ссылающееся на неизменяемый буфер.
+    Все ответы с одним файлом отправляют один и тот же буфер без копирования
+*/
+struct SharedBufferBody{
+    using value_type = std::shared_ptr<const std::string>;
+
+    static std::uint64_t size(const value_type& body){
+        return body ? body->size() : 0;
+    }
+
+    class writer{
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(const http::header<isRequest, Fields>&, const value_type& body)
+            : body_(body){
+        }
+
+        void init(beast::error_code& ec){
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>> get(beast::error_code& ec){
+            ec = {};
+            if(!body_ || body_->empty()){
+                return boost::none;
+            }
+            return std::make_pair(const_buffers_type(body_->data(), body_->size()), false);
+        }
+    private:
+        const value_type& body_;
+    };
+};
+
+/* ------------------------ SharedPartsBody ----------------------------------- */
+
+/*
+    Тело ответа 206, ссылающееся на диапазоны неизменяемого буфера.
+    Данные файла не копируются, в ответе хранятся только заголовки частей
+*/
+struct SharedPartsBody{
+    struct value_type{
+        std::shared_ptr<const std::string> buffer;
+        std::vector<sendfile_body::Part> parts;
+    };
+
+    static std::uint64_t size(const value_type& body){
+        return sendfile_body::PartsSize(body.parts);
+    }
+
+    class writer{
+    public:
+        using const_buffers_type = std::vector<net::const_buffer>;
+
+        template<bool isRequest, class Fields>
+        writer(const http::header<isRequest, Fields>&, const value_type& body)
+            : body_(body){
+        }
+
+        void init(beast::error_code& ec){
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>> get(beast::error_code& ec){
+            ec = {};
+            if(done_ || !body_.buffer){
+                return boost::none;
+            }
+            done_ = true;
+
+            const_buffers_type buffers;
+            buffers.reserve(body_.parts.size() * 2);
+            for(const auto& part : body_.parts){
+                if(!part.prefix.empty()){
+                    buffers.emplace_back(part.prefix.data(), part.prefix.size());
+                }
+                if(part.length > 0){
+                    buffers.emplace_back(body_.buffer->data() + part.offset, part.length);
+                }
+            }
+            return std::make_pair(std::move(buffers), false);
+        }
+    private:
+        const value_type& body_;
+        bool done_ = false;
+    };
+};
+
+/* ------------------------ Asset ----------------------------------- */
+
+struct Asset{
+    using Buffer = std::shared_ptr<const std::string>;
+
+    /* Содержимое файла или nullptr, если крупный файл отдаётся с диска через sendfile */
+    Buffer data;
+    /* Сжатый вариант, если файл хорошо сжимается, иначе nullptr */
+    Buffer gzip_data;
+    std::string content_type;
+    /* Сильный ETag, вычисленный по содержимому файла */
+    std::string etag;
+    uint64_t content_hash = 0;
+    /* Путь с хешем содержимого, по которому файл кэшируется бессрочно. Пуст для HTML */
+    std::string fingerprinted_path;
+    /* Запись манифеста является псевдонимом с хешем */
+    bool immutable = false;
+    uintmax_t file_size = 0;
+    fs::file_time_type modified;
+    fs::path path;
+};
+
+/* ------------------------ StaticCache ----------------------------------- */
+
+/*
+    Манифест каталога статических файлов, собранный в памяти при запуске.
+    Манифест неизменяем и подменяется целиком при пересборке (RCU),
+    поэтому читать его можно из любого потока без блокировок
+*/
+class StaticCache{
+public:
+    using Manifest = std::unordered_map<std::string, Asset>;
+    using ManifestPtr = std::shared_ptr<const Manifest>;
+
+    /* Файлы крупнее этого размера не кэшируются и отдаются с диска */
+    static constexpr uintmax_t MAX_CACHED_FILE_SIZE = 16 * 1024 * 1024;
+    /* Файлы меньше этого размера не сжимаются */
+    static constexpr size_t MIN_GZIP_SIZE = compression::MIN_COMPRESS_SIZE;
+    /* Несжимаемые файлы от этого размера не держатся в памяти и отправляются через sendfile */
+    static constexpr uintmax_t MIN_SENDFILE_SIZE = 256 * 1024;
+
+    explicit StaticCache(fs::path root);
+
+    StaticCache(const StaticCache&) = delete;
+    StaticCache& operator=(const StaticCache&) = delete;
+
+    ~StaticCache();
+
+    ManifestPtr GetManifest() const;
+
+    /*
+        Пересобирает манифест. Файлы, у которых не изменились
+        размер и время модификации, берутся из прежнего манифеста без чтения и сжатия
+    */
+    void Rebuild();
+
+    /* Запускает поток, пересобирающий манифест при изменениях в каталоге (inotify) */
+    void StartWatching();
+private:
+    void Watch(std::stop_token stop);
+
+    void AddWatches();
+
+    fs::path root_;
+    ManifestPtr manifest_;
+    std::mutex rebuild_mutex_;
+    int inotify_fd_ = -1;
+    std::jthread watcher_;
+};
+
+}  // namespace static_cache
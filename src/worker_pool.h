@@ -0,0 +1,130 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+/*
+    Пул потоков для параллельной обработки тика.
+    ParallelFor раздаёт индексы задач потокам пула и вызывающему потоку
+    и возвращает управление, когда все задачи выполнены.
+    Не предназначен для одновременного вызова из нескольких потоков
+*/
+class WorkerPool {
+public:
+    using Task = std::function<void(size_t index)>;
+
+    /* threads - общее число потоков, включая вызывающий ParallelFor */
+    explicit WorkerPool(unsigned threads) {
+        for (unsigned i = 1; i < threads; ++i) {
+            threads_.emplace_back([this] {
+                Work();
+            });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        threads_.clear();
+    }
+
+    unsigned GetSize() const noexcept {
+        return static_cast<unsigned>(threads_.size()) + 1;
+    }
+
+    void ParallelFor(size_t count, const Task& task) {
+        if (threads_.empty() || count < 2) {
+            for (size_t i = 0; i < count; ++i) {
+                task(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            task_ = &task;
+            count_ = count;
+            next_.store(0, std::memory_order_relaxed);
+            running_ = threads_.size();
+            error_ = nullptr;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+
+        RunTasks();
+
+        std::unique_lock lock(mutex_);
+        done_cv_.wait(lock, [this] {
+            return running_ == 0;
+        });
+        task_ = nullptr;
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+    }
+
+private:
+    void Work() {
+        uint64_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock lock(mutex_);
+                start_cv_.wait(lock, [this, seen_generation] {
+                    return stop_ || generation_ != seen_generation;
+                });
+                if (stop_) {
+                    return;
+                }
+                seen_generation = generation_;
+            }
+
+            RunTasks();
+
+            std::lock_guard lock(mutex_);
+            if (--running_ == 0) {
+                done_cv_.notify_one();
+            }
+        }
+    }
+
+    void RunTasks() {
+        for (size_t index = next_.fetch_add(1); index < count_; index = next_.fetch_add(1)) {
+            try {
+                (*task_)(index);
+            } catch (...) {
+                std::lock_guard lock(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    const Task* task_ = nullptr;
+    size_t count_ = 0;
+    std::atomic<size_t> next_{0};
+    size_t running_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::vector<std::jthread> threads_;
+};
+
+}  // namespace util
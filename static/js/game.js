@@ -164,6 +164,8 @@ class GameState {
     this.lostObjects = {};
     this.disappearingLoot = {};
     this.player_elems = {};
+    // Открытый канал WebSocket, пока он есть, состояние не опрашивается
+    this.socket = undefined;
 
     this._updateState(function() {
       self.stateLoaded = true;
@@ -173,6 +175,38 @@ class GameState {
       self.playersLoaded = true;
       self._startGame();
     });
+    this._connectSocket();
+  }
+
+  _connectSocket() {
+    if (window.WebSocket === undefined) {
+      return;
+    }
+
+    let self = this;
+    const protocol = location.protocol === 'https:' ? 'wss://' : 'ws://';
+    const socket = new WebSocket(protocol + location.host + '/api/v1/game/socket');
+    socket.onopen = function() {
+      // Заголовок Authorization в WebSocket не передать, токен уходит первым сообщением
+      socket.send(JSON.stringify({token: Cookies.get('authToken')}));
+    };
+    socket.onmessage = function(event) {
+      // Первое сообщение сервера означает, что токен принят
+      self.socket = socket;
+      const message = JSON.parse(event.data);
+      if (message.type == 'players') {
+        self._updatePlayersList(message.players);
+      } else if (message.type == 'state' && self.started) {
+        self.desiredState = message.state;
+        self.stateVersion = message.version;
+        self.stateTime = performance.now();
+        self._applyDesiredState();
+      }
+    };
+    socket.onclose = function() {
+      // Без канала клиент возвращается к опросу по HTTP
+      self.socket = undefined;
+    };
   }
 
   tick() {
@@ -183,14 +217,14 @@ class GameState {
     if (!this.started)
       return false;
 
-    if ((this.ticks % this.posUpdateInterval == 0 || this.requestInstantUpdate) && !this.updateInProgress) {
+    if (this.socket === undefined && (this.ticks % this.posUpdateInterval == 0 || this.requestInstantUpdate) && !this.updateInProgress) {
       this.requestInstantUpdate = false;
       this._updateState(function() {
         self._applyDesiredState();
       });
     }
 
-    if (this.ticks % this.playersUpdateInterval == 0 && !this.playersSuncInProgress) {
+    if (this.socket === undefined && this.ticks % this.playersUpdateInterval == 0 && !this.playersSuncInProgress) {
       this._syncPlayers(function(){});
     }
 
@@ -212,6 +246,11 @@ class GameState {
 
   _pressKey(keys, then) {
     const self = this;
+    if (this.socket !== undefined) {
+      this.socket.send(JSON.stringify({move: keys}));
+      then();
+      return;
+    }
     $.post({
       url: '/api/v1/game/player/action',
       dataType: 'json',
@@ -411,17 +450,38 @@ class GameState {
 
   _updateState(then) {
     let self = this;
-    $.get({
-      url: '/api/v1/game/state',
-      dataType: 'json',
-      beforeSend: function(xhr) {
-        xhr.setRequestHeader("Authorization", "Bearer " + Cookies.get('authToken'));
+    // Зная версию последнего состояния, клиент запрашивает только изменения после неё
+    const since = this.stateVersion !== undefined ? '?since=' + this.stateVersion : '';
+    // Состояние запрашивается в MessagePack: оно заметно короче JSON
+    fetch('/api/v1/game/state' + since, {
+      headers: {
+        'Authorization': 'Bearer ' + Cookies.get('authToken'),
+        'Accept': 'application/msgpack'
       }
-    }).done(function(x){
-      self.desiredState = x;
-      self.stateTime = performance.now();
-      then();
-    })
+    }).then(function(response) {
+      if (!response.ok) {
+        throw new Error(response.statusText);
+      }
+      return response.arrayBuffer().then(function(buffer) {
+        const x = decodeMsgpack(buffer);
+        self.desiredState = x.since !== undefined ? self._mergeDelta(x) : x;
+        self.stateVersion = response.headers.get('X-Snapshot-Version');
+        self.stateTime = performance.now();
+        then();
+      });
+    }).catch(function() {});
+  }
+
+  _mergeDelta(delta) {
+    const players = Object.assign({}, this.desiredState.players, delta.players);
+    for (const id of delta.removedPlayers) {
+      delete players[id];
+    }
+    const lostObjects = Object.assign({}, this.desiredState.lostObjects, delta.lostObjects);
+    for (const id of delta.removedObjects) {
+      delete lostObjects[id];
+    }
+    return {players: players, lostObjects: lostObjects};
   }
 
   _interpolateRotation(old_pos, new_pos) {
@@ -0,0 +1,78 @@
+// Декодер MessagePack для ответов сервера с Accept: application/msgpack.
+// Поддерживает все типы, кроме ext и timestamp: сервер их не использует
+function decodeMsgpack(buffer) {
+  const view = new DataView(buffer);
+  const utf8 = new TextDecoder();
+  let offset = 0;
+
+  function readString(length) {
+    const bytes = new Uint8Array(buffer, offset, length);
+    offset += length;
+    return utf8.decode(bytes);
+  }
+
+  function readArray(length) {
+    const result = new Array(length);
+    for (let i = 0; i < length; ++i) {
+      result[i] = read();
+    }
+    return result;
+  }
+
+  function readMap(length) {
+    const result = {};
+    for (let i = 0; i < length; ++i) {
+      const key = read();
+      result[key] = read();
+    }
+    return result;
+  }
+
+  function next(size, getter) {
+    const value = getter.call(view, offset);
+    offset += size;
+    return value;
+  }
+
+  function read() {
+    const marker = view.getUint8(offset++);
+    if (marker < 0x80) return marker;
+    if (marker < 0x90) return readMap(marker & 0x0f);
+    if (marker < 0xa0) return readArray(marker & 0x0f);
+    if (marker < 0xc0) return readString(marker & 0x1f);
+    if (marker >= 0xe0) return marker - 0x100;
+
+    switch (marker) {
+      case 0xc0: return null;
+      case 0xc2: return false;
+      case 0xc3: return true;
+      case 0xc4: return new Uint8Array(buffer.slice(offset, offset += next(1, view.getUint8)));
+      case 0xc5: return new Uint8Array(buffer.slice(offset, offset += next(2, view.getUint16)));
+      case 0xc6: return new Uint8Array(buffer.slice(offset, offset += next(4, view.getUint32)));
+      case 0xca: return next(4, view.getFloat32);
+      case 0xcb: return next(8, view.getFloat64);
+      case 0xcc: return next(1, view.getUint8);
+      case 0xcd: return next(2, view.getUint16);
+      case 0xce: return next(4, view.getUint32);
+      case 0xcf: return Number(next(8, view.getBigUint64));
+      case 0xd0: return next(1, view.getInt8);
+      case 0xd1: return next(2, view.getInt16);
+      case 0xd2: return next(4, view.getInt32);
+      case 0xd3: return Number(next(8, view.getBigInt64));
+      case 0xd9: return readString(next(1, view.getUint8));
+      case 0xda: return readString(next(2, view.getUint16));
+      case 0xdb: return readString(next(4, view.getUint32));
+      case 0xdc: return readArray(next(2, view.getUint16));
+      case 0xdd: return readArray(next(4, view.getUint32));
+      case 0xde: return readMap(next(2, view.getUint16));
+      case 0xdf: return readMap(next(4, view.getUint32));
+    }
+    throw new Error('Unsupported MessagePack marker 0x' + marker.toString(16));
+  }
+
+  return read();
+}
+
+if (typeof module !== 'undefined') {
+  module.exports = decodeMsgpack;
+}
@@ -0,0 +1,120 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <vector>
+
+#include "../src/model.h"
+
+using namespace model;
+using namespace std::literals;
+namespace {
+
+constexpr int ROADS_PER_AXIS = 200;
+constexpr int ROAD_STEP = 10;
+constexpr unsigned DOGS_COUNT = 1200;
+constexpr unsigned TICKS = 30;
+constexpr unsigned TICK_MS = 100;
+constexpr uint64_t SEED = 20240601;
+
+/* Собака в конце игры: то, что должно совпасть при любом способе обновления */
+struct DogResult {
+    int id;
+    unsigned score;
+    std::vector<unsigned> bag;
+
+    bool operator==(const DogResult&) const = default;
+};
+
+Game MakeGame(unsigned threads){
+    Game game;
+    Map map(Map::Id("grid"s), "Test grid"s);
+
+    const Coord last = (ROADS_PER_AXIS - 1) * ROAD_STEP;
+    for(int i = 0; i < ROADS_PER_AXIS; ++i){
+        map.AddRoad(Road{Road::HORIZONTAL, {0, i * ROAD_STEP}, last});
+        map.AddRoad(Road{Road::VERTICAL, {i * ROAD_STEP, 0}, last});
+    }
+    for(int i = 0; i < ROADS_PER_AXIS; i += 5){
+        map.AddOffice(Office(Office::Id("office"s + std::to_string(i)), {i * ROAD_STEP, i * ROAD_STEP}, {0, 0}));
+    }
+
+    LootType loot_type;
+    loot_type.value = 10;
+    map.AddLootType(loot_type);
+    map.AddBagCapacity(3);
+
+    game.AddMap(std::move(map));
+    game.SetLootGenerator(1000, 0.5);
+    game.SetRandomSeed(SEED);
+    if(threads > 0){
+        game.SetRegionDecomposition(threads, 16);
+    }
+    return game;
+}
+
+/* Остановившиеся собаки разворачиваются, как будто игрок нажал клавишу */
+void MoveDogs(GameSession& session, util::Random& random){
+    for(Dog& dog : session.GetDogs()){
+        if(*dog.GetSpeed() != PairDouble{0, 0}){
+            continue;
+        }
+        switch(random.NextBelow(4)){
+            case 0: dog.SetSpeed(Dog::Speed({4.0, 0})); break;
+            case 1: dog.SetSpeed(Dog::Speed({-4.0, 0})); break;
+            case 2: dog.SetSpeed(Dog::Speed({0, 4.0})); break;
+            default: dog.SetSpeed(Dog::Speed({0, -4.0})); break;
+        }
+    }
+}
+
+std::vector<DogResult> Play(unsigned threads){
+    Game game = MakeGame(threads);
+    GameSession* session = game.AddSession(Map::Id("grid"s));
+    for(unsigned i = 0; i < DOGS_COUNT; ++i){
+        session->AddDog(i, Dog::Name("dog"s), Dog::Position(session->GetRandomPos()),
+                        Dog::Speed({0, 0}), Direction::NORTH);
+    }
+    session->UpdateLoot(session->GetLootShortage());
+    game.ScheduleLootSpawn(session);
+
+    util::Random random(SEED);
+    for(unsigned tick = 0; tick < TICKS; ++tick){
+        MoveDogs(*session, random);
+        game.UpdateGameState(TICK_MS);
+    }
+
+    std::vector<DogResult> result;
+    for(const Dog& dog : session->GetDogs()){
+        DogResult dog_result{dog.GetId(), dog.GetScore(), {}};
+        for(const Loot& loot : *dog.GetBag()){
+            dog_result.bag.push_back(loot.id);
+        }
+        result.push_back(std::move(dog_result));
+    }
+    return result;
+}
+
+}  // namespace
+
+SCENARIO("Region decomposition matches serial update") {
+    GIVEN("a session played serially") {
+        const auto serial = Play(0);
+
+        unsigned total_score = 0;
+        for(const DogResult& dog : serial){
+            total_score += dog.score + dog.bag.size();
+        }
+        REQUIRE(total_score > 0);
+
+        WHEN("the same seed is played by regions") {
+            const auto by_regions = Play(4);
+
+            THEN("bags and scores are the same") {
+                REQUIRE(by_regions.size() == serial.size());
+                for(size_t i = 0; i < serial.size(); ++i){
+                    CHECK(by_regions[i] == serial[i]);
+                }
+            }
+        }
+    }
+}